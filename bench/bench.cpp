@@ -0,0 +1,380 @@
+/************************************************************************
+ Stage benchmarks of the spectrogram pipeline
+
+ Builds spectrogram.cpp directly, without faust, around the stand-in DSP of
+ bench_dsp.h, and times every stage over a matrix of analysis settings:
+
+   make bench                      default matrix, results on stdout
+   ./spectrogram-bench -quick      one small configuration, one run
+   ./spectrogram-bench -fft 1024,4096 -mel 128 > after.tsv
+   ./spectrogram-bench -baseline before.tsv
+
+ Results are tab-separated, one row per stage and configuration, behind a
+ versioned header; the columns only ever get appended to. Rows with a
+ matching row in a -baseline file get the ratio of their median times, so a
+ regression shows up as vs_baseline > 1.
+ ************************************************************************/
+
+#define SPECTROGRAM_BENCH
+#include "../spectrogram.cpp"
+
+namespace {
+
+const char *kFormatVersion = "spectrogram-bench 1";
+
+struct BenchOptions {
+  std::vector<int> fft_sizes;
+  std::vector<int> hop_sizes;
+  std::vector<int> mel_bands;
+  std::vector<double> durations;
+  std::vector<double> scales;
+  int repeat;
+  int threads;
+  std::string baseline_file;
+
+  BenchOptions()
+      : fft_sizes({512, 2048, 8192}), hop_sizes({128, 512}),
+        mel_bands({64, 128}), durations({10}), scales({1, 2}), repeat(3),
+        threads(0), baseline_file("") {}
+};
+
+// Comma-separated list of numbers
+template <typename T> bool parseList(const char *text, std::vector<T> &out) {
+  out.clear();
+  std::istringstream iss(text);
+  std::string item;
+  while (std::getline(iss, item, ',')) {
+    std::istringstream value(item);
+    T v;
+    if (!(value >> v) || !(v > 0)) {
+      return false;
+    }
+    out.push_back(v);
+  }
+  return !out.empty();
+}
+
+void printUsage(const char *program) {
+  std::cerr << "Usage: " << program << " [options]\n\n";
+  std::cerr << "  -fft <list>        FFT sizes (default: 512,2048,8192)\n";
+  std::cerr << "  -hop <list>        Hop sizes, larger than the FFT skipped "
+               "(default: 128,512)\n";
+  std::cerr << "  -mel <list>        Mel band counts (default: 64,128)\n";
+  std::cerr << "  -duration <list>   Render durations in seconds "
+               "(default: 10)\n";
+  std::cerr << "  -scale <list>      Image scales for encoding (default: 1,2)\n";
+  std::cerr << "  -repeat <n>        Timed runs per stage, median reported "
+               "(default: 3)\n";
+  std::cerr << "  -threads <n>       Worker threads (default: all cores)\n";
+  std::cerr << "  -baseline <file>   Compare against an earlier result file\n";
+  std::cerr << "  -quick             One small configuration, one run\n";
+}
+
+bool parseBenchOptions(int argc, char *argv[], BenchOptions &opts) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    bool ok = true;
+    if (arg == "-fft" && has_value) {
+      ok = parseList(argv[++i], opts.fft_sizes);
+    } else if (arg == "-hop" && has_value) {
+      ok = parseList(argv[++i], opts.hop_sizes);
+    } else if (arg == "-mel" && has_value) {
+      ok = parseList(argv[++i], opts.mel_bands);
+    } else if (arg == "-duration" && has_value) {
+      ok = parseList(argv[++i], opts.durations);
+    } else if (arg == "-scale" && has_value) {
+      ok = parseList(argv[++i], opts.scales);
+    } else if (arg == "-repeat" && has_value) {
+      opts.repeat = atoi(argv[++i]);
+      ok = opts.repeat > 0;
+    } else if (arg == "-threads" && has_value) {
+      opts.threads = atoi(argv[++i]);
+    } else if (arg == "-baseline" && has_value) {
+      opts.baseline_file = argv[++i];
+    } else if (arg == "-quick") {
+      opts.fft_sizes = {1024};
+      opts.hop_sizes = {256};
+      opts.mel_bands = {64};
+      opts.durations = {2};
+      opts.scales = {1};
+      opts.repeat = 1;
+    } else {
+      printUsage(argv[0]);
+      return false;
+    }
+    if (!ok) {
+      std::cerr << "Error: invalid value for " << arg << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// One row of results. Settings a stage does not depend on are 0 and
+// printed as "-".
+struct StageResult {
+  std::string stage;
+  int fft;
+  int hop;
+  int mel;
+  double duration;
+  double scale;
+  std::vector<double> seconds;
+  int64_t items; // Samples, frames, values or pixels per run
+
+  // Columns that identify the row across result files
+  std::string key(int threads) const {
+    std::ostringstream oss;
+    oss << stage << '\t' << column(fft) << '\t' << column(hop) << '\t'
+        << column(mel) << '\t' << column(duration) << '\t' << column(scale)
+        << '\t' << threads;
+    return oss.str();
+  }
+
+  template <typename T> static std::string column(T value) {
+    if (value == 0) {
+      return "-";
+    }
+    std::ostringstream oss;
+    oss << value;
+    return oss.str();
+  }
+};
+
+// Median time of every baseline row, by key
+std::map<std::string, double> loadBaseline(const std::string &path) {
+  std::map<std::string, double> medians;
+  std::ifstream file(path.c_str());
+  if (!file) {
+    std::cerr << "Warning: could not read baseline " << path << std::endl;
+    return medians;
+  }
+
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#' || line.compare(0, 6, "stage\t") == 0) {
+      continue;
+    }
+    std::vector<std::string> fields;
+    std::istringstream iss(line);
+    std::string field;
+    while (std::getline(iss, field, '\t')) {
+      fields.push_back(field);
+    }
+    if (fields.size() < 9) {
+      continue;
+    }
+    std::string key = fields[0];
+    for (int i = 1; i < 7; i++) {
+      key += '\t' + fields[i];
+    }
+    medians[key] = atof(fields[8].c_str());
+  }
+  return medians;
+}
+
+class ResultWriter {
+private:
+  int threads_;
+  std::map<std::string, double> baseline_;
+
+public:
+  ResultWriter(int threads, const std::map<std::string, double> &baseline)
+      : threads_(threads), baseline_(baseline) {
+    std::cout << "# " << kFormatVersion << "\n";
+    std::cout << "stage\tfft\thop\tmel\tduration\tscale\tthreads\truns\t"
+                 "median_s\tmin_s\titems\titems_per_s\tvs_baseline"
+              << std::endl;
+  }
+
+  void write(StageResult result) {
+    std::vector<double> &seconds = result.seconds;
+    std::sort(seconds.begin(), seconds.end());
+    size_t n = seconds.size();
+    double median = n % 2 ? seconds[n / 2]
+                          : 0.5 * (seconds[n / 2 - 1] + seconds[n / 2]);
+
+    std::string key = result.key(threads_);
+    std::ostringstream row;
+    row << key << '\t' << n << '\t' << std::scientific << std::setprecision(4)
+        << median << '\t' << seconds[0] << '\t' << result.items << '\t'
+        << (median > 0 ? result.items / median : 0) << '\t';
+
+    auto base = baseline_.find(key);
+    if (base != baseline_.end() && base->second > 0) {
+      row << std::fixed << std::setprecision(3) << median / base->second;
+    } else {
+      row << "-";
+    }
+    std::cout << row.str() << std::endl;
+  }
+};
+
+// Run fn repeat times, returning the wall time of each run
+template <typename Fn> std::vector<double> timeRuns(int repeat, Fn fn) {
+  std::vector<double> seconds;
+  for (int r = 0; r < repeat; r++) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    seconds.push_back(std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start)
+                          .count());
+  }
+  return seconds;
+}
+
+StageResult makeResult(const char *stage, const Options &opts) {
+  StageResult result;
+  result.stage = stage;
+  result.fft = opts.fft_size;
+  result.hop = opts.hop_size;
+  result.mel = opts.mel_bands;
+  result.duration = opts.duration;
+  result.scale = 0;
+  result.items = 0;
+  return result;
+}
+
+// Every analysis stage for one duration, FFT size, hop and mel band count
+void benchAnalysis(const Options &opts, const std::vector<Sample> &audio,
+                   const BenchOptions &bench, ResultWriter &writer) {
+  int n_threads = resolveThreads(opts.threads);
+  int n_frames = countFrames(audio.size(), opts.fft_size, opts.hop_size);
+
+  StageResult setup_result = makeResult("setup", opts);
+  setup_result.seconds = timeRuns(bench.repeat, [&]() {
+    AnalysisSetup setup(opts);
+    setup.batchFFT();
+    setup.frameFFT();
+  });
+  setup_result.items = 1;
+  writer.write(setup_result);
+
+  AnalysisSetup setup(opts);
+  const BatchedFFT &batch_fft = setup.batchFFT();
+
+  Matrix<float> spectrogram;
+  StageResult stft = makeResult("stft", opts);
+  stft.seconds = timeRuns(bench.repeat, [&]() {
+    spectrogram = computeSTFT(AudioView(audio), opts.hop_size, setup.window,
+                              batch_fft, setup.spectrum, n_threads);
+  });
+  stft.items = n_frames;
+  writer.write(stft);
+
+  // Mel projection with the dB conversion and range tracking fused in
+  Matrix<float> mel_spec;
+  ValueRange range;
+  StageResult mel = makeResult("mel_db", opts);
+  mel.seconds = timeRuns(bench.repeat, [&]() {
+    FrameFinisher finish(opts);
+    mel_spec = applyMelFilterbank(spectrogram, setup.filterbank, finish);
+    range = finish.range;
+  });
+  mel.items = n_frames;
+  writer.write(mel);
+  spectrogram = Matrix<float>();
+
+  StageResult stream = makeResult("stream", opts);
+  stream.seconds = timeRuns(bench.repeat, [&]() {
+    Matrix<float> streamed(n_frames, opts.mel_bands);
+    FrameFinisher finish(opts);
+    StreamingAnalyzer analyzer(opts.hop_size, setup.window, setup.frameFFT(),
+                               setup.spectrum, setup.filterbank, streamed,
+                               finish);
+    for (size_t pos = 0; pos < audio.size(); pos += opts.block_size) {
+      int count = (int)std::min<size_t>(opts.block_size, audio.size() - pos);
+      analyzer.push(&audio[pos], count);
+    }
+  });
+  stream.items = n_frames;
+  writer.write(stream);
+
+  std::vector<Matrix<uint16_t>> panels(1);
+  StageResult quantize = makeResult("quantize", opts);
+  quantize.seconds = timeRuns(bench.repeat, [&]() {
+    panels[0] = quantizeSpectrogram(mel_spec, range.min, range.max, n_threads);
+  });
+  quantize.items = (int64_t)n_frames * opts.mel_bands;
+  writer.write(quantize);
+
+  for (double scale : bench.scales) {
+    Options scaled = opts;
+    scaled.scale = scale;
+    std::vector<unsigned char> bytes;
+    StageResult encode = makeResult("encode", scaled);
+    encode.scale = scale;
+    encode.seconds = timeRuns(bench.repeat, [&]() {
+      bytes.clear();
+      writePNG("", panels, scaled, scaled.gate_duration, &bytes);
+    });
+    encode.items = (int64_t)(n_frames * scaled.hscale * scale) *
+                   (int64_t)(opts.mel_bands * scaled.vscale * scale);
+    writer.write(encode);
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  BenchOptions bench;
+  if (!parseBenchOptions(argc, argv, bench)) {
+    return 1;
+  }
+
+  LoadedDSP loaded;
+  std::string error_msg;
+  if (!loadDSP("", loaded, error_msg)) {
+    std::cerr << error_msg << std::endl;
+    return 1;
+  }
+
+  Options base;
+  base.quiet = true;
+  base.threads = bench.threads;
+  base.frequency = 440;
+  base.gain = 0.9f;
+  base.use_db = true;
+
+  std::map<std::string, double> baseline;
+  if (!bench.baseline_file.empty()) {
+    baseline = loadBaseline(bench.baseline_file);
+  }
+  ResultWriter writer(resolveThreads(bench.threads), baseline);
+
+  for (double duration : bench.durations) {
+    Options opts = base;
+    opts.duration = duration;
+    opts.gate_duration = duration / 2;
+
+    std::vector<std::vector<Sample>> channels(1);
+    StageResult synthesis = makeResult("synthesis", opts);
+    synthesis.fft = synthesis.hop = synthesis.mel = 0;
+    synthesis.seconds = timeRuns(bench.repeat, [&]() {
+      loaded.instance->init(opts.sample_rate);
+      synthesizeAudio(*loaded.instance, loaded.ui, opts, channels);
+    });
+    synthesis.items = channels[0].size();
+    writer.write(synthesis);
+
+    for (int fft_size : bench.fft_sizes) {
+      for (int hop_size : bench.hop_sizes) {
+        if (hop_size > fft_size) {
+          continue;
+        }
+        for (int mel_bands : bench.mel_bands) {
+          opts.fft_size = fft_size;
+          opts.hop_size = hop_size;
+          opts.mel_bands = mel_bands;
+          opts.fmax = opts.sample_rate / 2.0;
+          std::cerr << "fft " << fft_size << ", hop " << hop_size << ", mel "
+                    << mel_bands << ", " << duration << " s" << std::endl;
+          benchAnalysis(opts, channels[0], bench, writer);
+        }
+      }
+    }
+  }
+
+  return 0;
+}
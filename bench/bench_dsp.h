@@ -0,0 +1,136 @@
+/************************************************************************
+ Stand-in for a faust-generated DSP, used by the benchmarks so the
+ analysis pipeline can be built without faust. It is written the way the
+ faust C++ backend writes its classes and exposes the same interface as a
+ patch that follows the DSP requirements (gate, freq, gain).
+
+ Equivalent faust code:
+
+   import("stdfaust.lib");
+   freq = nentry("freq", 440, 20, 20000, 1);
+   gate = button("gate");
+   gain = hslider("gain", 0.5, 0, 1, 0.01);
+   env = gate : si.smoo;
+   fm = os.osc(freq + 3 * freq * os.osc(2 * freq));
+   process = (0.4 * os.osc(freq) + 0.4 * fm + 0.2 * no.noise) * env * gain,
+             fm * env * gain;
+
+ Output 0 mixes a sine, a two-operator FM voice and white noise, so the
+ spectrum has tonal, inharmonic and broadband content; output 1 is the FM
+ voice alone.
+ ************************************************************************/
+
+#ifndef SPECTROGRAM_BENCH_DSP_H
+#define SPECTROGRAM_BENCH_DSP_H
+
+#include <cmath>
+
+class mydsp : public dsp {
+private:
+  FAUSTFLOAT fEntry0;
+  FAUSTFLOAT fButton0;
+  FAUSTFLOAT fHslider0;
+  int fSampleRate;
+  float fConst0;
+  float fConst1;
+  float fRec0[2];
+  float fRec1[2];
+  float fRec2[2];
+  float fRec3[2];
+  int iRec4[2];
+
+public:
+  void metadata(Meta *m) {
+    m->declare("name", "bench");
+    m->declare("description", "Sine, FM and noise stand-in for benchmarks");
+  }
+
+  virtual int getNumInputs() { return 0; }
+  virtual int getNumOutputs() { return 2; }
+
+  static void classInit(int sample_rate) {}
+
+  virtual void instanceConstants(int sample_rate) {
+    fSampleRate = sample_rate;
+    fConst0 = 1.0f / std::min<float>(192000.0f, std::max<float>(1.0f, float(fSampleRate)));
+    // si.smoo: 44.1 Hz one-pole smoother
+    fConst1 = std::exp(-(277.0f * fConst0));
+  }
+
+  virtual void instanceResetUserInterface() {
+    fEntry0 = FAUSTFLOAT(440.0f);
+    fButton0 = FAUSTFLOAT(0.0f);
+    fHslider0 = FAUSTFLOAT(0.5f);
+  }
+
+  virtual void instanceClear() {
+    for (int l0 = 0; l0 < 2; l0 = l0 + 1) {
+      fRec0[l0] = 0.0f;
+      fRec1[l0] = 0.0f;
+      fRec2[l0] = 0.0f;
+      fRec3[l0] = 0.0f;
+      iRec4[l0] = 0;
+    }
+  }
+
+  virtual void init(int sample_rate) {
+    classInit(sample_rate);
+    instanceInit(sample_rate);
+  }
+
+  virtual void instanceInit(int sample_rate) {
+    instanceConstants(sample_rate);
+    instanceResetUserInterface();
+    instanceClear();
+  }
+
+  virtual mydsp *clone() { return new mydsp(); }
+
+  virtual int getSampleRate() { return fSampleRate; }
+
+  virtual void buildUserInterface(UI *ui_interface) {
+    ui_interface->openVerticalBox("bench");
+    ui_interface->addButton("gate", &fButton0);
+    ui_interface->addHorizontalSlider("gain", &fHslider0, FAUSTFLOAT(0.5f),
+                                      FAUSTFLOAT(0.0f), FAUSTFLOAT(1.0f),
+                                      FAUSTFLOAT(0.01f));
+    ui_interface->declare(&fEntry0, "unit", "Hz");
+    ui_interface->addNumEntry("freq", &fEntry0, FAUSTFLOAT(440.0f),
+                              FAUSTFLOAT(20.0f), FAUSTFLOAT(20000.0f),
+                              FAUSTFLOAT(1.0f));
+    ui_interface->closeBox();
+  }
+
+  virtual void compute(int count, FAUSTFLOAT **inputs, FAUSTFLOAT **outputs) {
+    FAUSTFLOAT *output0 = outputs[0];
+    FAUSTFLOAT *output1 = outputs[1];
+    float fSlow0 = fConst0 * float(fEntry0);
+    float fSlow1 = (1.0f - fConst1) * float(fButton0);
+    float fSlow2 = float(fHslider0);
+    for (int i0 = 0; i0 < count; i0 = i0 + 1) {
+      // Carrier sine
+      fRec0[0] = fRec0[1] + fSlow0 - std::floor(fRec0[1] + fSlow0);
+      // Modulator at twice the frequency, index 3
+      fRec1[0] = fRec1[1] + 2.0f * fSlow0 - std::floor(fRec1[1] + 2.0f * fSlow0);
+      float fTemp0 = fSlow0 * (1.0f + 3.0f * std::sin(6.28318548f * fRec1[0]));
+      fRec2[0] = fRec2[1] + fTemp0 - std::floor(fRec2[1] + fTemp0);
+      float fTemp1 = std::sin(6.28318548f * fRec2[0]);
+      // Gate envelope
+      fRec3[0] = fSlow1 + fConst1 * fRec3[1];
+      // White noise
+      iRec4[0] = 1103515245 * iRec4[1] + 12345;
+      float fTemp2 = fSlow2 * fRec3[0];
+      output0[i0] = FAUSTFLOAT(fTemp2 * (0.4f * std::sin(6.28318548f * fRec0[0]) +
+                                         0.4f * fTemp1 +
+                                         9.31322575e-11f * float(iRec4[0])));
+      output1[i0] = FAUSTFLOAT(fTemp2 * fTemp1);
+      fRec0[1] = fRec0[0];
+      fRec1[1] = fRec1[0];
+      fRec2[1] = fRec2[0];
+      fRec3[1] = fRec3[0];
+      iRec4[1] = iRec4[0];
+    }
+  }
+};
+
+#endif // SPECTROGRAM_BENCH_DSP_H
@@ -32,19 +32,61 @@
  ************************************************************************/
 
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cfloat>
 #include <cmath>
+#include <chrono>
 #include <complex>
+#include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <ctime>
-#include <fftw3.h>
+#include <fcntl.h>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 #include <map>
-#include <png.h>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <signal.h>
 #include <sstream>
 #include <string>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 
+// Build variants of this file:
+//   (default)            faust architecture: one executable per DSP
+//   SPECTROGRAM_PLUGIN   faust architecture: the DSP alone as a shared object
+//                        exposing createSpectrogramDSP(), no analysis code
+//   SPECTROGRAM_HOST     compiled directly, without faust: the analyzer alone,
+//                        loading DSP plugins with -dsp <file.so>
+//   SPECTROGRAM_BENCH    compiled directly, without faust, from bench/bench.cpp:
+//                        the stand-in DSP of bench/bench_dsp.h, no main()
+#ifndef SPECTROGRAM_PLUGIN
+#include <fftw3.h>
+#include <png.h>
+#endif
+
+#ifdef SPECTROGRAM_HOST
+#include <dlfcn.h>
+#endif
+
+// Hand-vectorized spectral kernels, selected at run time (see -simd)
+#if (defined(__x86_64__) || defined(__i386__)) &&                              \
+    (defined(__GNUC__) || defined(__clang__)) && !defined(SPECTROGRAM_PLUGIN)
+#define SPECTROGRAM_X86_KERNELS
+#include <immintrin.h>
+#endif
+
 #ifndef FAUSTFLOAT
 #define FAUSTFLOAT float
 #endif
@@ -60,8 +102,10 @@
 
 #if defined(_WIN32)
 #define RESTRICT __restrict
+#define NOINLINE __declspec(noinline)
 #else
 #define RESTRICT __restrict__
+#define NOINLINE __attribute__((noinline))
 #endif
 
 //==============================================================================
@@ -132,6 +176,10 @@ public:
   virtual dsp *clone() = 0;
 };
 
+// Interface version checked by the host when loading a plugin. It changes
+// with the dsp/UI classes above and with the size of FAUSTFLOAT.
+#define SPECTROGRAM_PLUGIN_ABI (100 + (int)sizeof(FAUSTFLOAT))
+
 /******************************************************************************
  *******************************************************************************
 
@@ -140,18 +188,39 @@ public:
  *******************************************************************************
  *******************************************************************************/
 
+#if !defined(SPECTROGRAM_HOST) && !defined(SPECTROGRAM_BENCH)
 << includeIntrinsic >>
+#endif
 
     /********************END ARCHITECTURE SECTION (part 1/2)****************/
 
     /**************************BEGIN USER SECTION **************************/
 
+#if defined(SPECTROGRAM_BENCH)
+#include "bench/bench_dsp.h"
+#elif !defined(SPECTROGRAM_HOST)
     << includeclass >>
+#endif
 
     /***************************END USER SECTION ***************************/
 
     /*******************BEGIN ARCHITECTURE SECTION (part 2/2)***************/
 
+#ifdef SPECTROGRAM_PLUGIN
+
+//==============================================================================
+// Plugin Entry Points
+//==============================================================================
+
+// Plugins are built with -fvisibility=hidden, only these two are exported
+#define SPECTROGRAM_EXPORT extern "C" __attribute__((visibility("default")))
+
+SPECTROGRAM_EXPORT int spectrogramPluginABI() { return SPECTROGRAM_PLUGIN_ABI; }
+
+SPECTROGRAM_EXPORT dsp *createSpectrogramDSP() { return new mydsp(); }
+
+#else
+
     //==============================================================================
     // Parameter Collector UI
     //==============================================================================
@@ -173,6 +242,28 @@ public:
 private:
   std::map<std::string, Parameter> params_;
 
+  // Every control is collected by label, so timelines can automate any of
+  // them; the last one wins when labels repeat. gate only counts when it is
+  // a button or checkbox, freq and gain only when they are sliders or
+  // numeric entries, and other widgets with these labels are ignored.
+  void addControl(const char *label, FAUSTFLOAT *zone, FAUSTFLOAT init,
+                  FAUSTFLOAT min, FAUSTFLOAT max, const char *type) {
+    std::string name(label);
+    bool is_switch =
+        strcmp(type, "button") == 0 || strcmp(type, "checkbox") == 0;
+    if ((name == "gate" && !is_switch) ||
+        ((name == "freq" || name == "gain") && is_switch)) {
+      return;
+    }
+    Parameter &p = params_[name];
+    p.zone = zone;
+    p.min = min;
+    p.max = max;
+    p.init = init;
+    p.type = type;
+    p.found = true;
+  }
+
 public:
   SpectrogramUI() {}
 
@@ -185,66 +276,28 @@ public:
   virtual void declare(FAUSTFLOAT *zone, const char *key, const char *value) {}
 
   virtual void addButton(const char *label, FAUSTFLOAT *zone) {
-    if (strcmp(label, "gate") == 0) {
-      params_["gate"].zone = zone;
-      params_["gate"].min = 0;
-      params_["gate"].max = 1;
-      params_["gate"].init = 0;
-      params_["gate"].type = "button";
-      params_["gate"].found = true;
-    }
+    addControl(label, zone, 0, 0, 1, "button");
   }
 
   virtual void addCheckButton(const char *label, FAUSTFLOAT *zone) {
-    if (strcmp(label, "gate") == 0) {
-      params_["gate"].zone = zone;
-      params_["gate"].min = 0;
-      params_["gate"].max = 1;
-      params_["gate"].init = 0;
-      params_["gate"].type = "checkbox";
-      params_["gate"].found = true;
-    }
+    addControl(label, zone, 0, 0, 1, "checkbox");
   }
 
   virtual void addVerticalSlider(const char *label, FAUSTFLOAT *zone,
                                  FAUSTFLOAT init, FAUSTFLOAT min,
                                  FAUSTFLOAT max, FAUSTFLOAT step) {
-    std::string lbl(label);
-    if (lbl == "freq" || lbl == "gain") {
-      params_[lbl].zone = zone;
-      params_[lbl].min = min;
-      params_[lbl].max = max;
-      params_[lbl].init = init;
-      params_[lbl].type = "vslider";
-      params_[lbl].found = true;
-    }
+    addControl(label, zone, init, min, max, "vslider");
   }
 
   virtual void addHorizontalSlider(const char *label, FAUSTFLOAT *zone,
                                    FAUSTFLOAT init, FAUSTFLOAT min,
                                    FAUSTFLOAT max, FAUSTFLOAT step) {
-    std::string lbl(label);
-    if (lbl == "freq" || lbl == "gain") {
-      params_[lbl].zone = zone;
-      params_[lbl].min = min;
-      params_[lbl].max = max;
-      params_[lbl].init = init;
-      params_[lbl].type = "hslider";
-      params_[lbl].found = true;
-    }
+    addControl(label, zone, init, min, max, "hslider");
   }
 
   virtual void addNumEntry(const char *label, FAUSTFLOAT *zone, FAUSTFLOAT init,
                            FAUSTFLOAT min, FAUSTFLOAT max, FAUSTFLOAT step) {
-    std::string lbl(label);
-    if (lbl == "freq" || lbl == "gain") {
-      params_[lbl].zone = zone;
-      params_[lbl].min = min;
-      params_[lbl].max = max;
-      params_[lbl].init = init;
-      params_[lbl].type = "nentry";
-      params_[lbl].found = true;
-    }
+    addControl(label, zone, init, min, max, "nentry");
   }
 
   virtual void addHorizontalBargraph(const char *label, FAUSTFLOAT *zone,
@@ -298,6 +351,17 @@ public:
     *p.zone = clamped;
   }
 
+  // Labels of all collected controls, sorted
+  std::vector<std::string> controlNames() const {
+    std::vector<std::string> names;
+    for (const auto &entry : params_) {
+      if (entry.second.found) {
+        names.push_back(entry.first);
+      }
+    }
+    return names;
+  }
+
   // Get parameter info
   const Parameter &getParameter(const std::string &name) const {
     static Parameter dummy;
@@ -306,6 +370,111 @@ public:
   }
 };
 
+//==============================================================================
+// Control Timeline
+//==============================================================================
+
+// One breakpoint of a -timeline file: the control reaches value at time,
+// either by jumping there (Step) or by ramping from the previous breakpoint
+// of the same control (Linear, or Exp for frequencies)
+struct ControlEvent {
+  enum Shape { Step, Linear, Exp };
+
+  double time; // Seconds
+  std::string param;
+  FAUSTFLOAT value;
+  Shape shape;
+  int line; // In the timeline file, for messages
+};
+
+// Read a timeline: one breakpoint per line, "<seconds> <control> <value>
+// [step|linear|exp]", '#' starts a comment. Events are sorted by time,
+// keeping file order for equal times.
+bool loadTimeline(const std::string &path, std::vector<ControlEvent> &events,
+                  std::string &error_msg) {
+  std::ifstream file(path.c_str());
+  if (!file) {
+    error_msg = "Error: Could not open timeline " + path;
+    return false;
+  }
+
+  events.clear();
+  std::string text;
+  for (int line = 1; std::getline(file, text); line++) {
+    std::istringstream iss(text.substr(0, text.find('#')));
+    std::vector<std::string> fields;
+    std::string field;
+    while (iss >> field) {
+      fields.push_back(field);
+    }
+    if (fields.empty()) {
+      continue;
+    }
+
+    ControlEvent event;
+    bool valid = fields.size() == 3 || fields.size() == 4;
+    if (valid) {
+      char *time_end = nullptr;
+      char *value_end = nullptr;
+      std::string shape = fields.size() == 4 ? fields[3] : "step";
+      event.time = strtod(fields[0].c_str(), &time_end);
+      event.param = fields[1];
+      event.value = (FAUSTFLOAT)strtod(fields[2].c_str(), &value_end);
+      event.shape = shape == "linear" ? ControlEvent::Linear
+                    : shape == "exp"  ? ControlEvent::Exp
+                                      : ControlEvent::Step;
+      event.line = line;
+      valid = *time_end == '\0' && *value_end == '\0' && event.time >= 0 &&
+              (shape == "step" || shape == "linear" || shape == "exp");
+    }
+
+    std::ostringstream oss;
+    oss << "Error: " << path << ":" << line << ": ";
+    if (!valid) {
+      error_msg = oss.str() +
+                  "expected <seconds> <control> <value> [step|linear|exp]";
+      return false;
+    }
+    if (event.shape == ControlEvent::Exp && !(event.value > 0)) {
+      error_msg = oss.str() + "exp ramps need positive values";
+      return false;
+    }
+    events.push_back(event);
+  }
+
+  std::stable_sort(events.begin(), events.end(),
+                   [](const ControlEvent &a, const ControlEvent &b) {
+                     return a.time < b.time;
+                   });
+  return true;
+}
+
+// Check that every automated control exists in the DSP, and warn about
+// values the engine will clamp
+bool validateTimeline(const std::vector<ControlEvent> &events,
+                      const SpectrogramUI &ui, std::string &error_msg) {
+  for (const auto &event : events) {
+    const SpectrogramUI::Parameter &p = ui.getParameter(event.param);
+    if (!p.found) {
+      std::ostringstream oss;
+      oss << "Error: timeline line " << event.line
+          << ": the DSP has no control \"" << event.param << "\" (controls:";
+      for (const auto &name : ui.controlNames()) {
+        oss << " " << name;
+      }
+      oss << ")";
+      error_msg = oss.str();
+      return false;
+    }
+    if (event.value < p.min || event.value > p.max) {
+      std::cerr << "Warning: timeline line " << event.line << ": "
+                << event.param << "=" << event.value << " exceeds range ["
+                << p.min << ", " << p.max << "], clamped" << std::endl;
+    }
+  }
+  return true;
+}
+
 //==============================================================================
 // Command Line Options
 //==============================================================================
@@ -319,11 +488,26 @@ struct Options {
 
   // Audio options
   int sample_rate;
+  int block_size;
+  bool stream;
+
+  // Control automation
+  std::string timeline_file;
+  std::vector<ControlEvent> timeline;
+
+  // Audio file input (replaces synthesis)
+  std::string input_file;
+  std::string input_format;
+  int input_channels;
 
   // FFT options
   int fft_size;
   int hop_size;
   std::string window_type;
+  int threads;
+  std::string plan_mode;
+  std::string wisdom_file;
+  bool use_wisdom;
 
   // Mel options
   int mel_bands;
@@ -335,8 +519,31 @@ struct Options {
   float scale;
   float hscale;
   float vscale;
+  int width;        // Fixed image width, frames pooled into columns (0: off)
+  int height;       // Fixed panel height (0: off)
+  std::string pool; // Column pooling with a fixed width
   std::string colormap;
   std::string layout;
+  int png_level;
+  std::string png_filter;
+
+  // Channels
+  std::string channels;
+  std::string panels;
+
+  // Numeric export
+  std::string export_file;
+  bool export_linear;
+  bool write_png;
+
+  // Live output
+  std::string live_path;
+  std::string live_format;
+
+  // Tile pyramid output (replaces the single PNG)
+  std::string tiles_dir;
+  int tile_size;
+  std::string tile_pool;
 
   // Visual elements
   bool colorbar;
@@ -350,15 +557,50 @@ struct Options {
   // Amplitude
   bool use_db;
   float db_min;
+  float db_max;
+  std::string norm;
+  bool power;
+  bool fast_log;
+  std::string simd;
+
+  // Parameter sweep
+  std::vector<std::string> sweep_axes;
+  std::string sweep_csv;
+  int jobs;
+
+  // Console output
+  bool quiet;
+
+  // Synthesis benchmark (used by the script's --autotune)
+  bool bench_synth;
+
+  // Per-stage profile report
+  std::string profile_file;
+
+  // Render server
+  bool server;
+  std::string socket_path;
+
+  // DSP plugin (host build only)
+  std::string dsp_plugin;
 
   // Constructor with defaults
   Options()
       : duration(0), gate_duration(0), frequency(0), gain(0),
-        sample_rate(44100), fft_size(2048), hop_size(512), window_type("hann"),
-        mel_bands(128), fmin(0), fmax(-1), output_file(""), scale(1.0),
-        hscale(1.0), vscale(1.0), colormap("hot"), layout("full"),
+        sample_rate(44100), block_size(256), stream(false), timeline_file(""),
+        input_file(""), input_format("auto"), input_channels(1), fft_size(2048),
+        hop_size(512), window_type("hann"), threads(0), plan_mode("estimate"),
+        wisdom_file(""), use_wisdom(true), mel_bands(128), fmin(0), fmax(-1),
+        output_file(""), scale(1.0), hscale(1.0), vscale(1.0), width(0),
+        height(0), pool("max"), colormap("hot"), layout("full"), png_level(-1),
+        png_filter("auto"), channels("0"), panels("stack"), export_file(""),
+        export_linear(false), write_png(true), live_path(""),
+        live_format("rgb"), tiles_dir(""), tile_size(256), tile_pool("max"),
         colorbar(true), title(true), axes(true), legend(true), gate_line(true),
-        gate_color("red"), gate_style("dashed"), use_db(false), db_min(-80.0) {}
+        gate_color("red"), gate_style("dashed"), use_db(false), db_min(-80.0),
+        db_max(0.0), norm("auto"), power(false), fast_log(false), simd("auto"),
+        sweep_csv(""), jobs(0), quiet(false), bench_synth(false),
+        profile_file(""), server(false), socket_path(""), dsp_plugin("") {}
 };
 
 //==============================================================================
@@ -367,19 +609,38 @@ struct Options {
 
 void printUsage(const char *program_name) {
   std::cerr << "Usage: " << program_name
-            << " [OPTIONS] <duration> <gate_duration> <frequency> <gain>\n\n";
+            << " [OPTIONS] <duration> <gate_duration> <frequency> <gain>\n";
+  std::cerr << "       " << program_name << " [OPTIONS] -input <file>\n\n";
   std::cerr << "Positional arguments:\n";
   std::cerr << "  duration        Total duration in seconds\n";
   std::cerr << "  gate_duration   Gate=1 duration in seconds (from start)\n";
   std::cerr << "  frequency       Frequency in Hz\n";
   std::cerr << "  gain            Gain value\n\n";
   std::cerr << "Audio options:\n";
-  std::cerr << "  -sr <rate>      Sample rate (default: 44100)\n\n";
+  std::cerr << "  -sr <rate>      Sample rate (default: 44100)\n";
+  std::cerr << "  -block <size>   Synthesis block size (default: 256)\n";
+  std::cerr << "  -stream         Analyze while synthesizing (bounded memory)\n";
+  std::cerr << "  -timeline <file> Automate controls: \"<seconds> <control> "
+               "<value> [step|linear|exp]\"\n";
+  std::cerr << "                  per line, ramps advance once per block\n\n";
+  std::cerr << "Audio file input (instead of the DSP and positional "
+               "arguments):\n";
+  std::cerr << "  -input <file>   Analyze a recording: WAV (16/24-bit, float), "
+               ".f32 or .s16\n";
+  std::cerr << "  -input-format <f> wav|f32|s16 (default: from the file)\n";
+  std::cerr << "  -input-channels <n> Interleaved channels of .f32/.s16 "
+               "files, at -sr (default: 1)\n\n";
   std::cerr << "FFT options:\n";
   std::cerr << "  -fft <size>     FFT size (default: 2048)\n";
   std::cerr << "  -hop <size>     Hop size (default: 512)\n";
   std::cerr << "  -window <type>  Window type: hann|hamming|blackman (default: "
-               "hann)\n\n";
+               "hann)\n";
+  std::cerr << "  -threads <n>    STFT worker threads (default: all cores)\n";
+  std::cerr << "  -plan <mode>    FFTW planning: estimate|measure|patient "
+               "(default: estimate)\n";
+  std::cerr << "  -wisdom <file>  FFTW wisdom cache (default: "
+               "~/.cache/faust2spectrogram/wisdom)\n";
+  std::cerr << "  -no-wisdom      Do not read or write FFTW wisdom\n\n";
   std::cerr << "Mel options:\n";
   std::cerr << "  -mel <bands>    Number of mel bands (default: 128)\n";
   std::cerr << "  -fmin <hz>      Min frequency for mel scale (default: 0)\n";
@@ -390,8 +651,23 @@ void printUsage(const char *program_name) {
   std::cerr << "  -scale <f>      Global scale factor (default: 1.0)\n";
   std::cerr << "  -hscale <f>     Horizontal scale (default: 1.0)\n";
   std::cerr << "  -vscale <f>     Vertical scale (default: 1.0)\n";
-  std::cerr << "  -cmap <type>    Colormap: viridis|magma|hot|gray (default: "
-               "hot)\n";
+  std::cerr << "  -width <px>     Fixed image width, pooling frames into "
+               "columns as they are computed\n";
+  std::cerr << "  -height <px>    Fixed height of each panel\n";
+  std::cerr << "  -pool <p>       Column pooling with -width: max|mean|rms "
+               "(default: max)\n";
+  std::cerr << "  -cmap <type>    Colormap: viridis|magma|inferno|hot|gray "
+               "(default: hot)\n";
+  std::cerr << "  -png-level <n>  zlib level 0 (fastest) to 9 (smallest) "
+               "(default: 6)\n";
+  std::cerr << "  -png-filter <f> Row filter: none|sub|up|avg|paeth|all|auto "
+               "(default: auto)\n";
+  std::cerr << "  -tiles <dir>    Write a zoomable tile pyramid instead of "
+               "one PNG\n";
+  std::cerr << "  -tile-size <n>  Tile width and height in pixels "
+               "(default: 256)\n";
+  std::cerr << "  -tile-pool <p>  Pooling between levels: max|mean "
+               "(default: max)\n";
   std::cerr << "  -layout <type>  Layout preset: full|minimal|scientific|raw "
                "(default: full)\n\n";
   std::cerr << "Visual elements:\n";
@@ -409,13 +685,72 @@ void printUsage(const char *program_name) {
                "red|white|yellow|cyan (default: red)\n";
   std::cerr << "  -gate-style <style>          Gate line style: "
                "solid|dashed|dotted (default: dashed)\n\n";
+  std::cerr << "Channels:\n";
+  std::cerr << "  -channels <l>   Signals to analyze: output numbers, all, mid, "
+               "side, sum (default: 0)\n";
+  std::cerr << "  -panels <mode>  Several signals: stack (one image) or files "
+               "(default: stack)\n\n";
+  std::cerr << "Numeric export:\n";
+  std::cerr << "  -export <file>  Write the values as float32: .npy, or raw "
+               "with a 64-byte header\n";
+  std::cerr << "  -export-linear  Export the linear STFT magnitudes instead of "
+               "mel bands\n";
+  std::cerr << "  -no-png         Skip image output\n\n";
+  std::cerr << "Live output (implies -stream):\n";
+  std::cerr << "  -live <path>    Write every mel frame as soon as it is "
+               "computed ('-' for stdout)\n";
+  std::cerr << "  -live-format <f> f32 (mel values) or rgb (colors over "
+               "-dbmin..-dbmax dB)\n";
+  std::cerr << "                  (default: rgb)\n\n";
   std::cerr << "Amplitude:\n";
   std::cerr << "  -db             Display in decibels\n";
-  std::cerr << "  -dbmin <val>    Minimum dB value (default: -80)\n\n";
+  std::cerr << "  -dbmin <val>    Minimum dB value (default: -80)\n";
+  std::cerr << "  -dbmax <val>    Top of the fixed range (default: 0)\n";
+  std::cerr << "  -norm <mode>    Color range: auto (data min/max) or fixed "
+               "(dbmin..dbmax)\n";
+  std::cerr << "  -power          Use the power spectrum instead of magnitude\n";
+  std::cerr << "  -fastlog        Vectorized approximate dB conversion "
+               "(error < 2e-4 dB)\n";
+  std::cerr << "  -simd <isa>     Kernels: auto|scalar|sse2|avx2|avx512 "
+               "(default: auto)\n\n";
+  std::cerr << "Parameter sweep (one render per point, positional arguments "
+               "are the defaults):\n";
+  std::cerr << "  -sweep <p>=<a>:<b>:<n>  n values from a to b for p\n";
+  std::cerr << "  -sweep <p>=<v1>,<v2>,.. Listed values for p\n";
+  std::cerr << "                          p: duration|gate|freq|gain "
+               "(repeat for a grid)\n";
+  std::cerr << "  -sweep-csv <file>       One point per row, header names "
+               "the columns\n";
+  std::cerr << "  -jobs <n>               Points rendered in parallel "
+               "(default: all cores)\n\n";
+  std::cerr << "Console:\n";
+  std::cerr << "  -quiet          Only print warnings and errors\n";
+  std::cerr << "  -bench-synth    Time synthesis only, print one result line\n";
+  std::cerr << "  -profile <file> Write per-stage timings as JSON ('-' for "
+               "stderr)\n\n";
+  std::cerr << "Render server (positional arguments come from each job):\n";
+  std::cerr << "  -server         Read newline-delimited JSON jobs from stdin\n";
+  std::cerr << "  -socket <path>  Serve jobs on a Unix domain socket\n\n";
+#ifdef SPECTROGRAM_HOST
+  std::cerr << "DSP:\n";
+  std::cerr << "  -dsp <file.so>  DSP plugin built with faust2spectrogram "
+               "--plugin\n\n";
+#endif
+}
+
+bool isKnownPNGFilter(const std::string &filter) {
+  return filter == "none" || filter == "sub" || filter == "up" ||
+         filter == "avg" || filter == "paeth" || filter == "all" ||
+         filter == "auto";
+}
+
+bool isKnownColormap(const std::string &colormap) {
+  return colormap == "viridis" || colormap == "magma" ||
+         colormap == "inferno" || colormap == "hot" || colormap == "gray";
 }
 
 bool parseCommandLine(int argc, char *argv[], Options &opts) {
-  if (argc < 5) {
+  if (argc < 2) {
     printUsage(argv[0]);
     return false;
   }
@@ -429,12 +764,32 @@ bool parseCommandLine(int argc, char *argv[], Options &opts) {
     if (arg[0] == '-') {
       if (arg == "-sr" && i + 1 < argc) {
         opts.sample_rate = atoi(argv[++i]);
+      } else if (arg == "-block" && i + 1 < argc) {
+        opts.block_size = atoi(argv[++i]);
+      } else if (arg == "-stream") {
+        opts.stream = true;
+      } else if (arg == "-timeline" && i + 1 < argc) {
+        opts.timeline_file = argv[++i];
+      } else if (arg == "-input" && i + 1 < argc) {
+        opts.input_file = argv[++i];
+      } else if (arg == "-input-format" && i + 1 < argc) {
+        opts.input_format = argv[++i];
+      } else if (arg == "-input-channels" && i + 1 < argc) {
+        opts.input_channels = atoi(argv[++i]);
       } else if (arg == "-fft" && i + 1 < argc) {
         opts.fft_size = atoi(argv[++i]);
       } else if (arg == "-hop" && i + 1 < argc) {
         opts.hop_size = atoi(argv[++i]);
       } else if (arg == "-window" && i + 1 < argc) {
         opts.window_type = argv[++i];
+      } else if (arg == "-threads" && i + 1 < argc) {
+        opts.threads = atoi(argv[++i]);
+      } else if (arg == "-plan" && i + 1 < argc) {
+        opts.plan_mode = argv[++i];
+      } else if (arg == "-wisdom" && i + 1 < argc) {
+        opts.wisdom_file = argv[++i];
+      } else if (arg == "-no-wisdom") {
+        opts.use_wisdom = false;
       } else if (arg == "-mel" && i + 1 < argc) {
         opts.mel_bands = atoi(argv[++i]);
       } else if (arg == "-fmin" && i + 1 < argc) {
@@ -449,8 +804,38 @@ bool parseCommandLine(int argc, char *argv[], Options &opts) {
         opts.hscale = atof(argv[++i]);
       } else if (arg == "-vscale" && i + 1 < argc) {
         opts.vscale = atof(argv[++i]);
+      } else if (arg == "-width" && i + 1 < argc) {
+        opts.width = atoi(argv[++i]);
+      } else if (arg == "-height" && i + 1 < argc) {
+        opts.height = atoi(argv[++i]);
+      } else if (arg == "-pool" && i + 1 < argc) {
+        opts.pool = argv[++i];
       } else if (arg == "-cmap" && i + 1 < argc) {
         opts.colormap = argv[++i];
+      } else if (arg == "-png-level" && i + 1 < argc) {
+        opts.png_level = atoi(argv[++i]);
+      } else if (arg == "-png-filter" && i + 1 < argc) {
+        opts.png_filter = argv[++i];
+      } else if (arg == "-channels" && i + 1 < argc) {
+        opts.channels = argv[++i];
+      } else if (arg == "-panels" && i + 1 < argc) {
+        opts.panels = argv[++i];
+      } else if (arg == "-export" && i + 1 < argc) {
+        opts.export_file = argv[++i];
+      } else if (arg == "-export-linear") {
+        opts.export_linear = true;
+      } else if (arg == "-live" && i + 1 < argc) {
+        opts.live_path = argv[++i];
+      } else if (arg == "-live-format" && i + 1 < argc) {
+        opts.live_format = argv[++i];
+      } else if (arg == "-no-png") {
+        opts.write_png = false;
+      } else if (arg == "-tiles" && i + 1 < argc) {
+        opts.tiles_dir = argv[++i];
+      } else if (arg == "-tile-size" && i + 1 < argc) {
+        opts.tile_size = atoi(argv[++i]);
+      } else if (arg == "-tile-pool" && i + 1 < argc) {
+        opts.tile_pool = argv[++i];
       } else if (arg == "-layout" && i + 1 < argc) {
         opts.layout = argv[++i];
       } else if (arg == "-colorbar") {
@@ -481,6 +866,35 @@ bool parseCommandLine(int argc, char *argv[], Options &opts) {
         opts.use_db = true;
       } else if (arg == "-dbmin" && i + 1 < argc) {
         opts.db_min = atof(argv[++i]);
+      } else if (arg == "-dbmax" && i + 1 < argc) {
+        opts.db_max = atof(argv[++i]);
+      } else if (arg == "-norm" && i + 1 < argc) {
+        opts.norm = argv[++i];
+      } else if (arg == "-power") {
+        opts.power = true;
+      } else if (arg == "-fastlog") {
+        opts.fast_log = true;
+      } else if (arg == "-simd" && i + 1 < argc) {
+        opts.simd = argv[++i];
+      } else if (arg == "-sweep" && i + 1 < argc) {
+        opts.sweep_axes.push_back(argv[++i]);
+      } else if (arg == "-sweep-csv" && i + 1 < argc) {
+        opts.sweep_csv = argv[++i];
+      } else if (arg == "-jobs" && i + 1 < argc) {
+        opts.jobs = atoi(argv[++i]);
+      } else if (arg == "-quiet") {
+        opts.quiet = true;
+      } else if (arg == "-bench-synth") {
+        opts.bench_synth = true;
+      } else if (arg == "-profile" && i + 1 < argc) {
+        opts.profile_file = argv[++i];
+      } else if (arg == "-server") {
+        opts.server = true;
+      } else if (arg == "-socket" && i + 1 < argc) {
+        opts.server = true;
+        opts.socket_path = argv[++i];
+      } else if (arg == "-dsp" && i + 1 < argc) {
+        opts.dsp_plugin = argv[++i];
       } else {
         std::cerr << "Unknown option: " << arg << std::endl;
         return false;
@@ -508,7 +922,38 @@ bool parseCommandLine(int argc, char *argv[], Options &opts) {
     }
   }
 
-  if (pos_arg_index != 4) {
+  if (!opts.timeline_file.empty()) {
+    std::string error_msg;
+    if (!loadTimeline(opts.timeline_file, opts.timeline, error_msg)) {
+      std::cerr << error_msg << std::endl;
+      return false;
+    }
+  }
+
+  if (!opts.input_file.empty()) {
+    if (!opts.timeline_file.empty()) {
+      std::cerr << "Error: -timeline needs a DSP, not -input" << std::endl;
+      return false;
+    }
+    if (pos_arg_index != 0) {
+      std::cerr << "Error: -input takes no positional arguments" << std::endl;
+      return false;
+    }
+    if (opts.server || !opts.sweep_axes.empty() || !opts.sweep_csv.empty()) {
+      std::cerr << "Error: -input cannot be combined with -server or a sweep"
+                << std::endl;
+      return false;
+    }
+    if (opts.input_format != "auto" && opts.input_format != "wav" &&
+        opts.input_format != "f32" && opts.input_format != "s16") {
+      std::cerr << "Error: -input-format must be wav, f32 or s16" << std::endl;
+      return false;
+    }
+    if (opts.input_channels <= 0) {
+      std::cerr << "Error: -input-channels must be positive" << std::endl;
+      return false;
+    }
+  } else if (pos_arg_index != 4 && !opts.server) {
     std::cerr << "Error: Missing required positional arguments" << std::endl;
     printUsage(argv[0]);
     return false;
@@ -531,8 +976,112 @@ bool parseCommandLine(int argc, char *argv[], Options &opts) {
     opts.gate_line = false;
   }
 
-  // Set fmax default if not specified
-  if (opts.fmax < 0) {
+  if (!isKnownColormap(opts.colormap)) {
+    std::cerr << "Warning: unknown colormap \"" << opts.colormap
+              << "\", using hot" << std::endl;
+    opts.colormap = "hot";
+  }
+
+  if (opts.png_level < -1 || opts.png_level > 9) {
+    std::cerr << "Error: -png-level must be between 0 and 9" << std::endl;
+    return false;
+  }
+
+  if (opts.panels != "stack" && opts.panels != "files") {
+    std::cerr << "Warning: unknown panel mode \"" << opts.panels
+              << "\", using stack" << std::endl;
+    opts.panels = "stack";
+  }
+
+  if (opts.export_linear && opts.export_file.empty()) {
+    std::cerr << "Warning: -export-linear has no effect without -export"
+              << std::endl;
+  }
+
+  if (opts.tile_size <= 0) {
+    std::cerr << "Error: -tile-size must be positive" << std::endl;
+    return false;
+  }
+
+  if (opts.tile_pool != "max" && opts.tile_pool != "mean") {
+    std::cerr << "Warning: unknown tile pooling \"" << opts.tile_pool
+              << "\", using max" << std::endl;
+    opts.tile_pool = "max";
+  }
+
+  if (opts.width < 0 || opts.height < 0) {
+    std::cerr << "Error: -width and -height must be positive" << std::endl;
+    return false;
+  }
+
+  if (opts.pool != "max" && opts.pool != "mean" && opts.pool != "rms") {
+    std::cerr << "Warning: unknown column pooling \"" << opts.pool
+              << "\", using max" << std::endl;
+    opts.pool = "max";
+  }
+
+  if (opts.width > 0 && !opts.live_path.empty()) {
+    std::cerr << "Error: -live writes every frame, it cannot be combined "
+                 "with -width"
+              << std::endl;
+    return false;
+  }
+
+  if (opts.norm != "auto" && opts.norm != "fixed") {
+    std::cerr << "Warning: unknown normalization \"" << opts.norm
+              << "\", using auto" << std::endl;
+    opts.norm = "auto";
+  }
+
+  if (opts.norm == "fixed" && !opts.use_db) {
+    std::cerr << "Error: -norm fixed needs -db" << std::endl;
+    return false;
+  }
+
+  if (opts.norm == "fixed" && opts.db_max <= opts.db_min) {
+    std::cerr << "Error: -dbmax must be above -dbmin" << std::endl;
+    return false;
+  }
+
+  if (!opts.live_path.empty()) {
+    if (opts.live_format != "f32" && opts.live_format != "rgb") {
+      std::cerr << "Error: -live-format must be f32 or rgb" << std::endl;
+      return false;
+    }
+    // Colors need a range known before the first frame
+    if (opts.live_format == "rgb" && opts.db_max <= opts.db_min) {
+      std::cerr << "Error: -dbmax must be above -dbmin" << std::endl;
+      return false;
+    }
+    if (!opts.sweep_axes.empty() || !opts.sweep_csv.empty()) {
+      std::cerr << "Error: -live cannot be combined with a sweep" << std::endl;
+      return false;
+    }
+    if (opts.server) {
+      std::cerr << "Error: -live cannot be combined with -server" << std::endl;
+      return false;
+    }
+    // Frames are only available one by one in the streaming pipeline
+    opts.stream = true;
+    // Progress messages would corrupt the stream
+    if (opts.live_path == "-") {
+      opts.quiet = true;
+    }
+  }
+
+  if (!opts.profile_file.empty() && opts.server) {
+    std::cerr << "Warning: -profile has no effect in server mode" << std::endl;
+    opts.profile_file.clear();
+  }
+
+  if (!isKnownPNGFilter(opts.png_filter)) {
+    std::cerr << "Warning: unknown PNG filter \"" << opts.png_filter
+              << "\", using auto" << std::endl;
+    opts.png_filter = "auto";
+  }
+
+  // Set fmax default if not specified (a WAV file brings its own rate)
+  if (opts.fmax < 0 && opts.input_file.empty()) {
     opts.fmax = opts.sample_rate / 2.0;
   }
 
@@ -562,519 +1111,4488 @@ std::string generateOutputFilename(const char *program_name,
     return opts.output_file;
   }
 
-  // Extract basename without extension
-  std::string base = program_name;
+  // Extract basename without extension (of the recording for -input)
+  std::string base = opts.input_file.empty() ? program_name : opts.input_file;
   size_t last_slash = base.find_last_of("/\\");
   if (last_slash != std::string::npos) {
     base = base.substr(last_slash + 1);
   }
+  size_t dot = base.find_last_of('.');
+  if (!opts.input_file.empty() && dot != std::string::npos && dot > 0) {
+    base = base.substr(0, dot);
+  }
 
   return base + "-" + generateTimestamp() + ".png";
 }
 
-//==============================================================================
-// Audio Synthesis
-//==============================================================================
-
-void synthesizeAudio(mydsp &dsp, SpectrogramUI &ui, const Options &opts,
-                     std::vector<float> &output) {
-  int num_samples = (int)(opts.duration * opts.sample_rate);
-  int gate_samples = (int)(opts.gate_duration * opts.sample_rate);
-
-  // Allocate output buffer
-  output.resize(num_samples);
-
-  // Set frequency and gain (constant during synthesis)
-  ui.setParameter("freq", opts.frequency);
-  ui.setParameter("gain", opts.gain);
-
-  // Allocate DSP buffers
-  int num_outputs = dsp.getNumOutputs();
-  FAUSTFLOAT **outputs = new FAUSTFLOAT *[num_outputs];
-  for (int i = 0; i < num_outputs; i++) {
-    outputs[i] = new FAUSTFLOAT[1]; // Single sample at a time
+// path with suffix inserted before its extension
+std::string suffixedPath(const std::string &path, const std::string &suffix) {
+  size_t slash = path.find_last_of('/');
+  size_t dot = path.find_last_of('.');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+    dot = path.size();
   }
+  return path.substr(0, dot) + suffix + path.substr(dot);
+}
 
-  // Synthesis loop (sample by sample)
-  for (int i = 0; i < num_samples; i++) {
-    // Update gate
-    FAUSTFLOAT gate_value = (i < gate_samples) ? 1.0f : 0.0f;
-    ui.setParameter("gate", gate_value);
+// Progress output, silenced by -quiet and for parallel sweep points
+std::ostream &info(const Options &opts) {
+  struct NullBuffer : public std::streambuf {
+    int overflow(int c) { return c; }
+  };
+  static NullBuffer null_buffer;
+  static std::ostream null_stream(&null_buffer);
+  return opts.quiet ? null_stream : std::cout;
+}
 
-    // Compute single sample
-    dsp.compute(1, nullptr, outputs);
+// Number of worker threads to use (0 means one per hardware thread)
+int resolveThreads(int requested) {
+  if (requested > 0) {
+    return requested;
+  }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
 
-    // Store first output channel
-    output[i] = outputs[0][0];
+// Split [0, count) into contiguous chunks and run fn(begin, end) on each
+// chunk in its own thread. Chunks are fixed by count and n_threads only, so
+// results written by index are deterministic.
+template <typename Fn> void parallelFor(int count, int n_threads, Fn fn) {
+  n_threads = std::max(1, std::min(n_threads, count));
+  if (n_threads == 1) {
+    fn(0, count);
+    return;
   }
 
-  // Cleanup
-  for (int i = 0; i < num_outputs; i++) {
-    delete[] outputs[i];
+  std::vector<std::thread> workers;
+  for (int t = 0; t < n_threads; t++) {
+    int begin = (int)((int64_t)count * t / n_threads);
+    int end = (int)((int64_t)count * (t + 1) / n_threads);
+    workers.push_back(std::thread(fn, begin, end));
+  }
+  for (auto &worker : workers) {
+    worker.join();
   }
-  delete[] outputs;
 }
 
 //==============================================================================
-// DSP and Signal Processing Functions
+// Profiling
 //==============================================================================
 
-// Window functions
-std::vector<float> createWindow(int size, const std::string &type) {
-  std::vector<float> window(size);
-
-  for (int i = 0; i < size; i++) {
-    float x = (float)i / (size - 1);
-
-    if (type == "hann") {
-      window[i] = 0.5f * (1.0f - std::cos(2.0f * M_PI * x));
-    } else if (type == "hamming") {
-      window[i] = 0.54f - 0.46f * std::cos(2.0f * M_PI * x);
-    } else if (type == "blackman") {
-      window[i] = 0.42f - 0.5f * std::cos(2.0f * M_PI * x) +
-                  0.08f * std::cos(4.0f * M_PI * x);
-    } else {
-      window[i] = 1.0f; // Rectangular
-    }
+#ifdef SPECTROGRAM_PROFILE_ALLOC
+// Bytes requested from operator new and alignedAlloc since startup, read by
+// -profile. Counting means replacing the global allocator for the whole
+// binary, DSP and libraries included, so it is only compiled into profiling
+// builds (faust2spectrogram adds the flag when -profile is given); other
+// builds report allocations as null. The replacements stay out of line:
+// once inlined, GCC pairs malloc and free across new and delete and reports
+// false mismatches.
+const bool kCountsAllocations = true;
+std::atomic<uint64_t> g_allocated_bytes(0);
+
+NOINLINE void *operator new(std::size_t size) {
+  g_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  void *ptr = malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
   }
-
-  return window;
+  return ptr;
 }
 
-// Hz to Mel conversion
-float hzToMel(float hz) { return 2595.0f * std::log10(1.0f + hz / 700.0f); }
+NOINLINE void *operator new[](std::size_t size) { return operator new(size); }
+NOINLINE void operator delete(void *ptr) noexcept { free(ptr); }
+NOINLINE void operator delete[](void *ptr) noexcept { free(ptr); }
 
-// Mel to Hz conversion
-float melToHz(float mel) {
-  return 700.0f * (std::pow(10.0f, mel / 2595.0f) - 1.0f);
+inline void countAllocation(size_t bytes) {
+  g_allocated_bytes.fetch_add(bytes, std::memory_order_relaxed);
 }
 
-// Create mel filterbank
-std::vector<std::vector<float>> createMelFilterbank(int n_mels, int fft_size,
-                                                    int sample_rate, float fmin,
-                                                    float fmax) {
+inline uint64_t allocatedBytes() {
+  return g_allocated_bytes.load(std::memory_order_relaxed);
+}
+#else
+const bool kCountsAllocations = false;
 
-  // Convert to mel scale
-  float mel_min = hzToMel(fmin);
-  float mel_max = hzToMel(fmax);
+inline void countAllocation(size_t) {}
+inline uint64_t allocatedBytes() { return 0; }
+#endif
 
-  // Create mel points (n_mels + 2 for edges)
-  std::vector<float> mel_points(n_mels + 2);
-  for (int i = 0; i < n_mels + 2; i++) {
-    mel_points[i] = mel_min + (mel_max - mel_min) * i / (n_mels + 1);
+// Allocation counter as a JSON value: null when it is not compiled in
+std::string allocationsJSON(uint64_t bytes) {
+  if (!kCountsAllocations) {
+    return "null";
   }
+  std::ostringstream oss;
+  oss << bytes;
+  return oss.str();
+}
 
-  // Convert mel points to Hz then to FFT bins
-  std::vector<int> bin_points(n_mels + 2);
-  int n_fft_bins = fft_size / 2 + 1;
-  for (int i = 0; i < n_mels + 2; i++) {
-    float hz = melToHz(mel_points[i]);
-    bin_points[i] = (int)std::floor((fft_size + 1) * hz / sample_rate);
+// Peak resident set size of the process so far, in bytes
+int64_t peakRSS() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
   }
+#ifdef __APPLE__
+  return (int64_t)usage.ru_maxrss;
+#else
+  return (int64_t)usage.ru_maxrss * 1024;
+#endif
+}
 
-  // Create triangular filters
-  std::vector<std::vector<float>> filterbank(n_mels);
-  for (int i = 0; i < n_mels; i++) {
-    filterbank[i].resize(n_fft_bins, 0.0f);
+// Wall time, CPU time and allocations per pipeline stage, for -profile.
+// Entries are summed by stage name: a stage entered several times (streaming
+// blocks, sweep points, signals analyzed concurrently) reports the total.
+// CPU time is the whole process's, so concurrent stages share theirs.
+class Profiler {
+private:
+  struct Stage {
+    std::string name;
+    double wall;
+    double cpu;
+    uint64_t allocated;
+    int64_t peak_rss; // After the last entry
+    int64_t calls;
+  };
 
-    int left = bin_points[i];
-    int center = bin_points[i + 1];
-    int right = bin_points[i + 2];
+  std::mutex mutex_;
+  std::vector<Stage> stages_; // In order of first entry
+  std::chrono::steady_clock::time_point start_;
+  std::clock_t cpu_start_;
+  std::atomic<int64_t> samples_;
+  std::atomic<int64_t> frames_;
+  bool enabled_;
 
-    // Rising slope
-    for (int j = left; j < center; j++) {
-      filterbank[i][j] = (float)(j - left) / (center - left);
-    }
+  Profiler() : cpu_start_(0), samples_(0), frames_(0), enabled_(false) {}
 
-    // Falling slope
-    for (int j = center; j < right; j++) {
-      filterbank[i][j] = (float)(right - j) / (right - center);
-    }
+public:
+  static Profiler &instance() {
+    static Profiler profiler;
+    return profiler;
   }
 
-  return filterbank;
-}
+  // Start the report clock. Nothing is recorded before this.
+  void enable() {
+    start_ = std::chrono::steady_clock::now();
+    cpu_start_ = std::clock();
+    enabled_ = true;
+  }
 
-// STFT computation
-std::vector<std::vector<float>> computeSTFT(const std::vector<float> &audio,
-                                            int fft_size, int hop_size,
-                                            const std::vector<float> &window) {
+  bool enabled() const { return enabled_; }
+
+  void record(const char *name, double wall, double cpu, uint64_t allocated) {
+    int64_t rss = peakRSS();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &stage : stages_) {
+      if (stage.name == name) {
+        stage.wall += wall;
+        stage.cpu += cpu;
+        stage.allocated += allocated;
+        stage.peak_rss = rss;
+        stage.calls++;
+        return;
+      }
+    }
+    Stage stage = {name, wall, cpu, allocated, rss, 1};
+    stages_.push_back(stage);
+  }
 
-  int n_frames = (audio.size() - fft_size) / hop_size + 1;
-  int n_bins = fft_size / 2 + 1;
+  // Throughput counters
+  void addSamples(int64_t count) { samples_ += count; }
+  void addFrames(int64_t count) { frames_ += count; }
+
+  // Write the report as JSON to path ("-" for stderr)
+  bool write(const std::string &path, const Options &opts) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    double total_wall = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start_)
+                            .count();
+    double total_cpu = (double)(std::clock() - cpu_start_) / CLOCKS_PER_SEC;
+    double synthesis_wall = 0;
+    double analysis_wall = 0;
+    for (const auto &stage : stages_) {
+      if (stage.name == "synthesis" || stage.name == "read") {
+        synthesis_wall += stage.wall;
+      } else if (stage.name == "stft" || stage.name == "mel" ||
+                 stage.name == "analysis") {
+        analysis_wall += stage.wall;
+      }
+    }
 
-  std::vector<std::vector<float>> spectrogram(n_frames);
+    std::ostringstream json;
+    json << std::fixed << std::setprecision(6);
+    json << "{\n"
+         << "  \"wall_s\": " << total_wall << ",\n"
+         << "  \"cpu_s\": " << total_cpu << ",\n"
+         << "  \"peak_rss_bytes\": " << peakRSS() << ",\n"
+         << "  \"allocated_bytes\": " << allocationsJSON(allocatedBytes())
+         << ",\n"
+         << "  \"samples\": " << samples_ << ",\n"
+         << "  \"frames\": " << frames_ << ",\n"
+         << "  \"samples_per_s\": "
+         << (synthesis_wall > 0 ? samples_ / synthesis_wall : 0) << ",\n"
+         << "  \"frames_per_s\": "
+         << (analysis_wall > 0 ? frames_ / analysis_wall : 0) << ",\n"
+         << "  \"fft\": " << opts.fft_size << ",\n"
+         << "  \"hop\": " << opts.hop_size << ",\n"
+         << "  \"threads\": " << resolveThreads(opts.threads) << ",\n";
+
+    // Compile times measured by the faust2spectrogram script, when it built
+    // this binary for the current run
+    const char *faust_s = getenv("FAUST2SPECTROGRAM_FAUST_SECONDS");
+    const char *cxx_s = getenv("FAUST2SPECTROGRAM_CXX_SECONDS");
+    if (faust_s && cxx_s) {
+      json << "  \"compile\": {\"faust_s\": " << atof(faust_s)
+           << ", \"cxx_s\": " << atof(cxx_s) << "},\n";
+    }
 
-  // Allocate FFTW structures
-  float *in = (float *)fftwf_malloc(sizeof(float) * fft_size);
-  fftwf_complex *out =
-      (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * n_bins);
-  fftwf_plan plan = fftwf_plan_dft_r2c_1d(fft_size, in, out, FFTW_ESTIMATE);
+    json << "  \"stages\": [";
+    for (size_t i = 0; i < stages_.size(); i++) {
+      const Stage &stage = stages_[i];
+      json << (i > 0 ? "," : "") << "\n    {\"name\": \"" << stage.name
+           << "\", \"wall_s\": " << stage.wall << ", \"cpu_s\": " << stage.cpu
+           << ", \"allocated_bytes\": " << allocationsJSON(stage.allocated)
+           << ", \"peak_rss_bytes\": " << stage.peak_rss
+           << ", \"calls\": " << stage.calls << "}";
+    }
+    json << "\n  ]\n}\n";
 
-  for (int frame = 0; frame < n_frames; frame++) {
-    spectrogram[frame].resize(n_bins);
+    if (path == "-") {
+      std::cerr << json.str();
+      return true;
+    }
+    std::ofstream file(path.c_str());
+    file << json.str();
+    if (!file) {
+      std::cerr << "Error: Could not write " << path << std::endl;
+      return false;
+    }
+    return true;
+  }
+};
 
-    int offset = frame * hop_size;
+// Times the enclosing scope, or until stop(), as one entry of a stage. Does
+// nothing unless profiling is enabled.
+class ProfileScope {
+private:
+  const char *name_;
+  bool active_;
+  std::chrono::steady_clock::time_point start_;
+  std::clock_t cpu_start_;
+  uint64_t allocated_start_;
 
-    // Apply window and copy to FFT input
-    for (int i = 0; i < fft_size; i++) {
-      in[i] = audio[offset + i] * window[i];
+public:
+  explicit ProfileScope(const char *name)
+      : name_(name), active_(Profiler::instance().enabled()), cpu_start_(0),
+        allocated_start_(0) {
+    if (active_) {
+      start_ = std::chrono::steady_clock::now();
+      cpu_start_ = std::clock();
+      allocated_start_ = allocatedBytes();
     }
+  }
 
-    // Execute FFT
-    fftwf_execute(plan);
+  ~ProfileScope() { stop(); }
 
-    // Compute magnitude spectrum
-    for (int i = 0; i < n_bins; i++) {
-      float real = out[i][0];
-      float imag = out[i][1];
-      spectrogram[frame][i] = std::sqrt(real * real + imag * imag);
+  void stop() {
+    if (!active_) {
+      return;
     }
+    active_ = false;
+    double wall = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start_)
+                      .count();
+    double cpu = (double)(std::clock() - cpu_start_) / CLOCKS_PER_SEC;
+    uint64_t allocated = allocatedBytes() - allocated_start_;
+    Profiler::instance().record(name_, wall, cpu, allocated);
   }
 
-  // Cleanup
-  fftwf_destroy_plan(plan);
-  fftwf_free(in);
-  fftwf_free(out);
+private:
+  ProfileScope(const ProfileScope &);
+  ProfileScope &operator=(const ProfileScope &);
+};
 
-  return spectrogram;
+//==============================================================================
+// Contiguous Matrix
+//==============================================================================
+
+void *alignedAlloc(size_t bytes, size_t alignment) {
+  countAllocation(bytes);
+#if defined(_WIN32)
+  void *ptr = _aligned_malloc(bytes, alignment);
+#else
+  void *ptr = nullptr;
+  if (posix_memalign(&ptr, alignment, bytes) != 0) {
+    ptr = nullptr;
+  }
+#endif
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
 }
 
-// Apply mel filterbank to spectrogram
-std::vector<std::vector<float>>
-applyMelFilterbank(const std::vector<std::vector<float>> &spectrogram,
-                   const std::vector<std::vector<float>> &filterbank) {
+void alignedFree(void *ptr) {
+#if defined(_WIN32)
+  _aligned_free(ptr);
+#else
+  free(ptr);
+#endif
+}
 
-  int n_frames = spectrogram.size();
-  int n_mels = filterbank.size();
+// Row-major 2D buffer held in a single aligned allocation. The stride is
+// padded so every row starts on a 64-byte boundary. T must be a trivially
+// copyable type (samples, pixels); new storage is zero-filled.
+template <typename T> class Matrix {
+private:
+  T *data_;
+  int rows_;
+  int cols_;
+  int stride_;
+
+  static int paddedStride(int cols) {
+    int stride = std::max(cols, 1);
+    while ((stride * sizeof(T)) % kAlignment != 0) {
+      stride++;
+    }
+    return stride;
+  }
 
-  std::vector<std::vector<float>> mel_spec(n_frames);
+public:
+  static const size_t kAlignment = 64;
 
-  for (int frame = 0; frame < n_frames; frame++) {
-    mel_spec[frame].resize(n_mels);
+  Matrix() : data_(nullptr), rows_(0), cols_(0), stride_(0) {}
 
-    for (int mel = 0; mel < n_mels; mel++) {
-      float sum = 0.0f;
-      for (size_t bin = 0; bin < spectrogram[frame].size(); bin++) {
-        sum += spectrogram[frame][bin] * filterbank[mel][bin];
-      }
-      mel_spec[frame][mel] = sum;
-    }
+  Matrix(int rows, int cols) : data_(nullptr), rows_(0), cols_(0), stride_(0) {
+    resize(rows, cols);
   }
 
-  return mel_spec;
-}
+  Matrix(Matrix &&other)
+      : data_(other.data_), rows_(other.rows_), cols_(other.cols_),
+        stride_(other.stride_) {
+    other.data_ = nullptr;
+    other.rows_ = other.cols_ = other.stride_ = 0;
+  }
 
-// Convert to dB scale
-void convertToDb(std::vector<std::vector<float>> &mel_spec, float db_min) {
-  for (auto &frame : mel_spec) {
-    for (auto &val : frame) {
-      if (val > 0) {
-        val = 20.0f * std::log10(val);
-        val = std::max(val, db_min);
-      } else {
-        val = db_min;
-      }
+  Matrix &operator=(Matrix &&other) {
+    if (this != &other) {
+      alignedFree(data_);
+      data_ = other.data_;
+      rows_ = other.rows_;
+      cols_ = other.cols_;
+      stride_ = other.stride_;
+      other.data_ = nullptr;
+      other.rows_ = other.cols_ = other.stride_ = 0;
     }
+    return *this;
   }
-}
 
-// Normalize spectrogram to [0, 1]
-void normalizeSpectrogram(std::vector<std::vector<float>> &mel_spec) {
-  float min_val = 1e10f;
-  float max_val = -1e10f;
+  ~Matrix() { alignedFree(data_); }
+
+  // Reallocate to rows x cols; previous contents are discarded
+  void resize(int rows, int cols) {
+    alignedFree(data_);
+    data_ = nullptr;
+    rows_ = std::max(rows, 0);
+    cols_ = std::max(cols, 0);
+    stride_ = paddedStride(cols_);
+    size_t bytes = sizeof(T) * stride_ * std::max<size_t>(rows_, 1);
+    data_ = (T *)alignedAlloc(bytes, kAlignment);
+    memset((void *)data_, 0, bytes);
+  }
+
+  int rows() const { return rows_; }
+  int cols() const { return cols_; }
+  int stride() const { return stride_; }
+  bool empty() const { return rows_ == 0 || cols_ == 0; }
+
+  T *row(int r) { return data_ + (size_t)r * stride_; }
+  const T *row(int r) const { return data_ + (size_t)r * stride_; }
+
+  T &operator()(int r, int c) { return row(r)[c]; }
+  const T &operator()(int r, int c) const { return row(r)[c]; }
+
+private:
+  Matrix(const Matrix &);
+  Matrix &operator=(const Matrix &);
+};
+
+//==============================================================================
+// FFT Planning
+//==============================================================================
+
+// The FFTW API for a sample type: fftwf_* for float, fftw_* for double.
+// Only the specialization the build uses is referenced, so a float build
+// links libfftw3f alone and a double one libfftw3 alone.
+template <typename Real> struct FFTW;
+
+template <> struct FFTW<float> {
+  typedef fftwf_complex Complex;
+  typedef fftwf_plan Plan;
+
+  static const char *wisdomSuffix() { return ""; }
+  static void *malloc(size_t bytes) { return fftwf_malloc(bytes); }
+  static void free(void *p) { fftwf_free(p); }
+  static Plan planBatch(int n, int batch, float *in, Complex *out,
+                        unsigned flags) {
+    return fftwf_plan_many_dft_r2c(1, &n, batch, in, nullptr, 1, n, out,
+                                   nullptr, 1, n / 2 + 1, flags);
+  }
+  static void execute(Plan plan, float *in, Complex *out) {
+    fftwf_execute_dft_r2c(plan, in, out);
+  }
+  static void destroy(Plan plan) { fftwf_destroy_plan(plan); }
+  static int importWisdom(const char *path) {
+    return fftwf_import_wisdom_from_filename(path);
+  }
+  static int exportWisdom(const char *path) {
+    return fftwf_export_wisdom_to_filename(path);
+  }
+};
+
+template <> struct FFTW<double> {
+  typedef fftw_complex Complex;
+  typedef fftw_plan Plan;
+
+  // fftw and fftwf wisdom cannot be mixed in one file
+  static const char *wisdomSuffix() { return "-double"; }
+  static void *malloc(size_t bytes) { return fftw_malloc(bytes); }
+  static void free(void *p) { fftw_free(p); }
+  static Plan planBatch(int n, int batch, double *in, Complex *out,
+                        unsigned flags) {
+    return fftw_plan_many_dft_r2c(1, &n, batch, in, nullptr, 1, n, out,
+                                  nullptr, 1, n / 2 + 1, flags);
+  }
+  static void execute(Plan plan, double *in, Complex *out) {
+    fftw_execute_dft_r2c(plan, in, out);
+  }
+  static void destroy(Plan plan) { fftw_destroy_plan(plan); }
+  static int importWisdom(const char *path) {
+    return fftw_import_wisdom_from_filename(path);
+  }
+  static int exportWisdom(const char *path) {
+    return fftw_export_wisdom_to_filename(path);
+  }
+};
+
+// Sample type of the whole pipeline, from synthesis to the FFT input. It is
+// the DSP's FAUSTFLOAT, so a build with -DFAUSTFLOAT=double (faust -double)
+// keeps double precision from the DSP outputs through the transform. The
+// spectra are stored as float in both cases.
+typedef FAUSTFLOAT Sample;
+typedef FFTW<Sample>::Complex SampleComplex;
+
+// Number of frames transformed by one batched FFT execution
+const int kFFTBatch = 16;
+
+// The FFTW planner is not thread-safe: plan creation and destruction are
+// serialized when several renders run in parallel
+std::mutex &plannerMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+unsigned planFlags(const std::string &mode) {
+  if (mode == "measure") {
+    return FFTW_MEASURE;
+  } else if (mode == "patient") {
+    return FFTW_PATIENT;
+  } else if (mode == "exhaustive") {
+    return FFTW_EXHAUSTIVE;
+  }
+  return FFTW_ESTIMATE;
+}
+
+// Create every missing directory of path (like mkdir -p)
+bool makeDirectories(const std::string &path) {
+  for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1)) {
+    std::string dir = path.substr(0, pos);
+    struct stat st;
+    if (stat(dir.c_str(), &st) != 0) {
+#if defined(_WIN32)
+      if (mkdir(dir.c_str()) != 0) {
+#else
+      if (mkdir(dir.c_str(), 0755) != 0) {
+#endif
+        return false;
+      }
+    }
+    if (pos == std::string::npos) {
+      return true;
+    }
+  }
+}
+
+// Wisdom file shared by every generated binary on this machine
+std::string wisdomPath(const Options &opts) {
+  if (!opts.wisdom_file.empty()) {
+    return opts.wisdom_file;
+  }
+  const char *cache = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  if (cache != nullptr && cache[0] != '\0') {
+    return std::string(cache) + "/faust2spectrogram/wisdom" +
+           FFTW<Sample>::wisdomSuffix();
+  } else if (home != nullptr && home[0] != '\0') {
+    return std::string(home) + "/.cache/faust2spectrogram/wisdom" +
+           FFTW<Sample>::wisdomSuffix();
+  }
+  return "";
+}
+
+void importWisdom(const Options &opts) {
+  std::string path = wisdomPath(opts);
+  if (opts.use_wisdom && !path.empty()) {
+    FFTW<Sample>::importWisdom(path.c_str());
+  }
+}
+
+// Export accumulated wisdom. Plans made with FFTW_ESTIMATE add nothing worth
+// saving. The file is written under a temporary name and renamed so that
+// concurrent runs never read a partial file.
+void exportWisdom(const Options &opts) {
+  std::string path = wisdomPath(opts);
+  if (!opts.use_wisdom || path.empty() ||
+      planFlags(opts.plan_mode) == FFTW_ESTIMATE) {
+    return;
+  }
+
+  size_t slash = path.find_last_of('/');
+  if (slash != std::string::npos && slash > 0) {
+    makeDirectories(path.substr(0, slash));
+  }
+
+  std::ostringstream tmp;
+  tmp << path << ".tmp." << getpid();
+  if (FFTW<Sample>::exportWisdom(tmp.str().c_str())) {
+    if (rename(tmp.str().c_str(), path.c_str()) != 0) {
+      remove(tmp.str().c_str());
+    }
+  }
+}
+
+// Batched real-to-complex FFT over `batch` frames. Frame k reads fft_size
+// samples at in + k * fft_size and writes fft_size/2+1 bins at
+// out + k * (fft_size/2+1). Planning uses private scratch arrays, so
+// measured plans never clobber caller data; execute() is thread-safe as
+// long as the arrays come from allocInput() and allocOutput().
+template <typename Real> class BasicBatchedFFT {
+public:
+  typedef FFTW<Real> API;
+  typedef typename API::Complex Complex;
+
+private:
+  typename API::Plan plan_;
+  int fft_size_;
+  int batch_;
+
+public:
+  BasicBatchedFFT(int fft_size, int batch, unsigned flags)
+      : fft_size_(fft_size), batch_(std::max(1, batch)) {
+    Real *in = allocInput();
+    Complex *out = allocOutput();
+    std::lock_guard<std::mutex> lock(plannerMutex());
+    plan_ = API::planBatch(fft_size_, batch_, in, out, flags);
+    API::free(in);
+    API::free(out);
+  }
+
+  ~BasicBatchedFFT() {
+    std::lock_guard<std::mutex> lock(plannerMutex());
+    API::destroy(plan_);
+  }
+
+  int batch() const { return batch_; }
+  int fftSize() const { return fft_size_; }
+
+  Real *allocInput() const {
+    return (Real *)API::malloc(sizeof(Real) * fft_size_ * batch_);
+  }
+
+  Complex *allocOutput() const {
+    return (Complex *)API::malloc(sizeof(Complex) * (fft_size_ / 2 + 1) *
+                                  batch_);
+  }
+
+  static void release(void *buffer) { API::free(buffer); }
+
+  void execute(Real *in, Complex *out) const { API::execute(plan_, in, out); }
+
+private:
+  BasicBatchedFFT(const BasicBatchedFFT &);
+  BasicBatchedFFT &operator=(const BasicBatchedFFT &);
+};
+
+typedef BasicBatchedFFT<Sample> BatchedFFT;
+
+//==============================================================================
+// DSP Loading
+//==============================================================================
+
+// A DSP instance and its parameter bindings. In the host build the DSP code
+// comes from a plugin opened with dlopen, which stays loaded as long as the
+// instance exists; otherwise it is the mydsp class compiled into this file.
+struct LoadedDSP {
+  void *handle;
+  dsp *instance;
+  SpectrogramUI ui;
+
+  LoadedDSP() : handle(nullptr), instance(nullptr) {}
+  ~LoadedDSP() {
+    delete instance;
+#ifdef SPECTROGRAM_HOST
+    if (handle != nullptr) {
+      dlclose(handle);
+    }
+#endif
+  }
+
+private:
+  LoadedDSP(const LoadedDSP &);
+  LoadedDSP &operator=(const LoadedDSP &);
+};
+
+// Create the DSP, bind its parameters and check that it exposes gate, freq
+// and gain. The instance is not initialized.
+bool loadDSP(const std::string &path, LoadedDSP &loaded,
+             std::string &error_msg) {
+#ifdef SPECTROGRAM_HOST
+  if (path.empty()) {
+    error_msg = "Error: No DSP given, use -dsp <file.so>";
+    return false;
+  }
+
+  // Without a slash dlopen searches the library path instead of the
+  // current directory
+  std::string file = path.find('/') == std::string::npos ? "./" + path : path;
+  loaded.handle = dlopen(file.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (loaded.handle == nullptr) {
+    error_msg = std::string("Error: Cannot load DSP plugin: ") + dlerror();
+    return false;
+  }
+
+  typedef int (*ABIFunction)();
+  typedef dsp *(*FactoryFunction)();
+  ABIFunction abi = (ABIFunction)dlsym(loaded.handle, "spectrogramPluginABI");
+  FactoryFunction factory =
+      (FactoryFunction)dlsym(loaded.handle, "createSpectrogramDSP");
+  if (abi == nullptr || factory == nullptr) {
+    error_msg = "Error: " + path + " is not a spectrogram DSP plugin";
+    return false;
+  }
+  if (abi() != SPECTROGRAM_PLUGIN_ABI) {
+    error_msg = "Error: " + path +
+                " was built for another version of spectrogram.cpp or "
+                "another sample type, rebuild it";
+    return false;
+  }
+  loaded.instance = factory();
+#else
+  if (!path.empty()) {
+    error_msg = "Error: -dsp needs the plugin host, this executable has its "
+                "DSP built in";
+    return false;
+  }
+  loaded.instance = new mydsp();
+#endif
+
+  if (loaded.instance == nullptr) {
+    error_msg = "Failed to create DSP object";
+    return false;
+  }
+
+  loaded.instance->buildUserInterface(&loaded.ui);
+  return loaded.ui.validate(error_msg);
+}
+
+//==============================================================================
+// Audio Synthesis
+//==============================================================================
+
+// Block-based synthesis engine. Parameter zones are resolved once at
+// construction so no map lookup runs inside the render loop. Every automated
+// control (the gate, and the controls of a -timeline) is a track of
+// breakpoints; blocks are split at breakpoints so steps land on the exact
+// sample, and ramps move at control rate, once per block.
+class SynthEngine {
+public:
+  static const char *const kStage; // Profile stage of render()
+
+private:
+  struct Breakpoint {
+    int64_t sample;
+    FAUSTFLOAT value;
+    ControlEvent::Shape shape;
+  };
+
+  struct Track {
+    FAUSTFLOAT *zone;
+    std::vector<Breakpoint> points;
+    size_t next;         // First breakpoint not reached yet
+    int64_t from_sample; // Last breakpoint passed, where a ramp starts
+    FAUSTFLOAT from_value;
+
+    // Set the zone for a block starting at position and return the number
+    // of samples until the next breakpoint
+    int64_t update(int64_t position) {
+      while (next < points.size() && points[next].sample <= position) {
+        from_sample = points[next].sample;
+        from_value = points[next].value;
+        *zone = from_value;
+        next++;
+      }
+      if (next == points.size()) {
+        return std::numeric_limits<int64_t>::max();
+      }
+
+      const Breakpoint &to = points[next];
+      if (to.shape != ControlEvent::Step) {
+        double t = (double)(position - from_sample) / (to.sample - from_sample);
+        if (to.shape == ControlEvent::Exp && from_value > 0) {
+          *zone = (FAUSTFLOAT)(from_value * std::pow(to.value / from_value, t));
+        } else {
+          *zone = (FAUSTFLOAT)(from_value + (to.value - from_value) * t);
+        }
+      }
+      return to.sample - position;
+    }
+  };
+
+  dsp &dsp_;
+  std::vector<Track> tracks_;
+  int64_t num_samples_;
+  int block_size_;
+  int64_t position_;
+  std::vector<FAUSTFLOAT *> outputs_;
+  std::vector<FAUSTFLOAT> scratch_;
+
+public:
+  SynthEngine(dsp &dsp, SpectrogramUI &ui, const Options &opts)
+      : dsp_(dsp),
+        num_samples_((int64_t)((double)opts.duration * opts.sample_rate)),
+        block_size_(std::max(1, opts.block_size)), position_(0) {
+    // Frequency and gain start at the positional values
+    ui.setParameter("freq", opts.frequency);
+    ui.setParameter("gain", opts.gain);
+
+    // A control on the timeline follows only its breakpoints (the gate then
+    // starts closed); otherwise the gate is open for gate_duration
+    std::map<std::string, size_t> track_of;
+    for (const auto &event : opts.timeline) {
+      const SpectrogramUI::Parameter &p = ui.getParameter(event.param);
+      if (!p.found) {
+        continue;
+      }
+      if (track_of.find(event.param) == track_of.end()) {
+        track_of[event.param] = tracks_.size();
+        if (event.param == "gate") {
+          *p.zone = 0;
+        }
+        Track track = {p.zone, {}, 0, 0, *p.zone};
+        tracks_.push_back(track);
+      }
+      Breakpoint point = {(int64_t)(event.time * opts.sample_rate),
+                          std::max(p.min, std::min(event.value, p.max)),
+                          event.shape};
+      tracks_[track_of[event.param]].points.push_back(point);
+    }
+    if (track_of.find("gate") == track_of.end()) {
+      int64_t gate_samples =
+          (int64_t)((double)opts.gate_duration * opts.sample_rate);
+      Track gate = {ui.getParameter("gate").zone, {}, 0, 0, 0};
+      gate.points.push_back({0, gate_samples > 0 ? 1.0f : 0.0f,
+                             ControlEvent::Step});
+      if (gate_samples > 0) {
+        gate.points.push_back({gate_samples, 0.0f, ControlEvent::Step});
+      }
+      tracks_.push_back(gate);
+    }
+
+    // Captured channels are written straight into the caller's buffers, the
+    // other channels go to a scratch block that is discarded
+    int num_outputs = dsp_.getNumOutputs();
+    outputs_.resize(std::max(num_outputs, 1));
+    scratch_.resize(block_size_ * num_outputs);
+  }
+
+  int64_t numSamples() const { return num_samples_; }
+  int64_t position() const { return position_; }
+  bool done() const { return position_ >= num_samples_; }
+
+  // Render up to max_count samples of channels 0 .. n_dst - 1 into dst[0] ..
+  // dst[n_dst - 1]. Returns the number of samples written, which is shorter
+  // than requested when the block ends on the gate transition or at the end
+  // of the render.
+  int render(FAUSTFLOAT *const *dst, int n_dst, int max_count) {
+    int64_t count = std::min<int64_t>(std::min(max_count, block_size_),
+                                      num_samples_ - position_);
+    if (count <= 0) {
+      return 0;
+    }
+
+    // Controls change at block starts, and blocks end at the next breakpoint
+    for (auto &track : tracks_) {
+      count = std::min(count, track.update(position_));
+    }
+    for (int i = 0; i < (int)outputs_.size(); i++) {
+      outputs_[i] = (i < n_dst) ? dst[i] : &scratch_[i * block_size_];
+    }
+    dsp_.compute((int)count, nullptr, &outputs_[0]);
+
+    position_ += count;
+    return (int)count;
+  }
+
+  // Channel 0 only
+  int render(FAUSTFLOAT *dst, int max_count) {
+    return render(&dst, 1, max_count);
+  }
+};
+
+const char *const SynthEngine::kStage = "synthesis";
+
+// Synthesize channels 0 .. channels.size() - 1
+void synthesizeAudio(dsp &dsp, SpectrogramUI &ui, const Options &opts,
+                     std::vector<std::vector<Sample>> &channels) {
+  SynthEngine engine(dsp, ui, opts);
+
+  // Allocate output buffers
+  for (auto &channel : channels) {
+    channel.resize(engine.numSamples());
+  }
+
+  // Synthesis loop (block by block, straight into the output buffers)
+  std::vector<FAUSTFLOAT *> dst(channels.size());
+  while (!engine.done()) {
+    int64_t pos = engine.position();
+    for (size_t i = 0; i < channels.size(); i++) {
+      dst[i] = &channels[i][pos];
+    }
+    engine.render(dst.empty() ? nullptr : &dst[0], (int)dst.size(),
+                  (int)std::min<int64_t>(engine.numSamples() - pos, INT32_MAX));
+  }
+}
+
+// A signal to analyze: one DSP output channel, or a mix of outputs 0 and 1
+// (mid, side) or of all captured outputs (sum)
+struct SignalSource {
+  enum Kind { Channel, Mid, Side, Sum };
+  Kind kind;
+  int channel;
+  std::string name;
+};
+
+// Resolve the -channels list against the DSP's outputs
+bool resolveSignals(const std::string &list, int num_outputs,
+                    std::vector<SignalSource> &signals,
+                    std::string &error_msg) {
+  signals.clear();
+  if (num_outputs < 1) {
+    error_msg = "Error: the DSP has no outputs";
+    return false;
+  }
+
+  std::istringstream iss(list);
+  std::string token;
+  while (std::getline(iss, token, ',')) {
+    SignalSource source;
+    source.channel = -1;
+    source.name = token;
+    if (token == "all") {
+      for (int c = 0; c < num_outputs; c++) {
+        source.kind = SignalSource::Channel;
+        source.channel = c;
+        source.name = "ch" + std::to_string(c);
+        signals.push_back(source);
+      }
+      continue;
+    } else if (token == "mid" || token == "side") {
+      if (num_outputs < 2) {
+        error_msg = "Error: \"" + token + "\" needs a DSP with 2 outputs";
+        return false;
+      }
+      source.kind = token == "mid" ? SignalSource::Mid : SignalSource::Side;
+    } else if (token == "sum") {
+      source.kind = SignalSource::Sum;
+    } else {
+      char *end = nullptr;
+      long c = strtol(token.c_str(), &end, 10);
+      if (token.empty() || *end != '\0' || c < 0 || c >= num_outputs) {
+        std::ostringstream oss;
+        oss << "Error: invalid channel \"" << token << "\" (the DSP has "
+            << num_outputs << " outputs)";
+        error_msg = oss.str();
+        return false;
+      }
+      source.kind = SignalSource::Channel;
+      source.channel = (int)c;
+      source.name = "ch" + token;
+    }
+    signals.push_back(source);
+  }
+
+  if (signals.empty()) {
+    error_msg = "Error: no channel to analyze";
+    return false;
+  }
+  return true;
+}
+
+// Number of DSP outputs that must be captured (outputs 0 .. n - 1) for the
+// signals
+int capturedChannels(const std::vector<SignalSource> &signals,
+                     int num_outputs) {
+  int n = 0;
+  for (const auto &source : signals) {
+    if (source.kind == SignalSource::Channel) {
+      n = std::max(n, source.channel + 1);
+    } else if (source.kind == SignalSource::Sum) {
+      n = num_outputs;
+    } else {
+      n = std::max(n, 2);
+    }
+  }
+  return n;
+}
+
+// Compute count samples of a mixed signal from the captured channels
+void mixSignal(const SignalSource &source, const Sample *const *channels,
+               int n_channels, int64_t count, Sample *RESTRICT out) {
+  if (source.kind == SignalSource::Sum) {
+    std::fill(out, out + count, Sample(0));
+    for (int c = 0; c < n_channels; c++) {
+      const Sample *RESTRICT in = channels[c];
+      for (int64_t i = 0; i < count; i++) {
+        out[i] += in[i];
+      }
+    }
+    return;
+  }
+
+  const Sample *RESTRICT left = channels[0];
+  const Sample *RESTRICT right = channels[1];
+  const Sample sign = (source.kind == SignalSource::Mid) ? 1 : -1;
+  for (int64_t i = 0; i < count; i++) {
+    out[i] = Sample(0.5) * (left[i] + sign * right[i]);
+  }
+}
+
+// Time synthesis alone (no analysis) and print a single parseable line:
+//   bench-synth samples=<n> seconds=<s> ns_per_sample=<t>
+void benchmarkSynthesis(dsp &dsp, SpectrogramUI &ui, const Options &opts) {
+  SynthEngine engine(dsp, ui, opts);
+  std::vector<Sample> block(std::max(1, opts.block_size));
+
+  auto start = std::chrono::steady_clock::now();
+  while (!engine.done()) {
+    engine.render(&block[0], (int)block.size());
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  std::cout << "bench-synth samples=" << engine.numSamples()
+            << " seconds=" << seconds << " ns_per_sample="
+            << seconds * 1e9 / std::max<int64_t>(engine.numSamples(), 1)
+            << std::endl;
+}
+
+//==============================================================================
+// Audio File Input
+//==============================================================================
+
+// Read-only view of one channel of audio: samples in memory (a synthesized
+// buffer, or a mapped float file), or 16/24-bit PCM in a mapped file.
+// Interleaved channels are read in place through the stride, so a view never
+// copies the audio.
+struct AudioView {
+  enum Encoding { Float32, Float64, Int16, Int24 };
+
+  const unsigned char *data; // First sample of the channel
+  Encoding encoding;
+  int stride;     // Bytes from one sample to the next
+  int64_t length; // Samples
+
+  AudioView() : data(nullptr), encoding(Float32), stride(4), length(0) {}
+
+  template <typename Real>
+  explicit AudioView(const std::vector<Real> &samples)
+      : data((const unsigned char *)samples.data()),
+        encoding(sizeof(Real) == sizeof(double) ? Float64 : Float32),
+        stride(sizeof(Real)), length((int64_t)samples.size()) {}
+
+  static int bytesPerSample(Encoding encoding) {
+    return encoding == Int16 ? 2 : encoding == Int24 ? 3
+                               : encoding == Float64 ? 8 : 4;
+  }
+
+  // Samples start .. start + count - 1 in [-1, 1), converted to Real and
+  // multiplied by window[i] when a window is given
+  template <typename Real>
+  void read(int64_t start, int count, Real *RESTRICT dst,
+            const Real *RESTRICT window = nullptr) const {
+    const unsigned char *src = data + start * stride;
+
+    // Samples already in the analysis type are read in place
+    if (encoding == (sizeof(Real) == sizeof(double) ? Float64 : Float32) &&
+        stride == sizeof(Real) && (uintptr_t)src % alignof(Real) == 0) {
+      const Real *RESTRICT in = (const Real *)src;
+      if (window) {
+        for (int i = 0; i < count; i++) {
+          dst[i] = in[i] * window[i];
+        }
+      } else {
+        memcpy(dst, in, sizeof(Real) * count);
+      }
+      return;
+    }
+
+    for (int i = 0; i < count; i++, src += stride) {
+      Real v;
+      if (encoding == Float32) {
+        float f;
+        memcpy(&f, src, sizeof(f));
+        v = (Real)f;
+      } else if (encoding == Float64) {
+        double d;
+        memcpy(&d, src, sizeof(d));
+        v = (Real)d;
+      } else if (encoding == Int16) {
+        int16_t pcm;
+        memcpy(&pcm, src, sizeof(pcm));
+        v = pcm * Real(1.0 / 32768.0);
+      } else {
+        int32_t pcm = (int32_t)((uint32_t)src[0] << 8 | (uint32_t)src[1] << 16 |
+                                (uint32_t)src[2] << 24) >>
+                      8;
+        v = pcm * Real(1.0 / 8388608.0);
+      }
+      dst[i] = window ? v * window[i] : v;
+    }
+  }
+};
+
+// A whole file mapped read-only into memory. Pages are loaded on demand by
+// the kernel, so files larger than RAM can be analyzed.
+class MappedFile {
+private:
+  void *data_;
+  size_t size_;
+
+public:
+  MappedFile() : data_(nullptr), size_(0) {}
+  ~MappedFile() {
+    if (data_) {
+      munmap(data_, size_);
+    }
+  }
+
+  bool open(const std::string &path, std::string &error_msg) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+      error_msg = "Error: Could not open " + path + ": " + strerror(errno);
+      if (fd >= 0) {
+        close(fd);
+      }
+      return false;
+    }
+    if (st.st_size == 0) {
+      error_msg = "Error: " + path + " is empty";
+      close(fd);
+      return false;
+    }
+
+    size_ = (size_t)st.st_size;
+    data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data_ == MAP_FAILED) {
+      data_ = nullptr;
+      error_msg = "Error: Could not map " + path + ": " + strerror(errno);
+      return false;
+    }
+    // Frames are read front to back
+    madvise(data_, size_, MADV_SEQUENTIAL);
+    return true;
+  }
+
+  const unsigned char *data() const { return (const unsigned char *)data_; }
+  size_t size() const { return size_; }
+
+private:
+  MappedFile(const MappedFile &);
+  MappedFile &operator=(const MappedFile &);
+};
+
+// An audio file for -input: WAV (16/24-bit PCM or 32/64-bit float, plain or
+// WAVE_FORMAT_EXTENSIBLE), or headerless interleaved float32 (.f32) or
+// int16 (.s16) at -sr with -input-channels. Samples are little-endian, as in
+// WAV files.
+struct AudioFile {
+  MappedFile file;
+  AudioView::Encoding encoding;
+  int channels;
+  int sample_rate;
+  const unsigned char *samples; // First frame
+  int64_t frames;
+
+  AudioFile()
+      : encoding(AudioView::Float32), channels(0), sample_rate(0),
+        samples(nullptr), frames(0) {}
+
+  // Channel c, limited to the first max_frames frames when max_frames > 0
+  AudioView channel(int c, int64_t max_frames = 0) const {
+    AudioView view;
+    int bytes = AudioView::bytesPerSample(encoding);
+    view.data = samples + (size_t)c * bytes;
+    view.encoding = encoding;
+    view.stride = bytes * channels;
+    view.length = max_frames > 0 ? std::min(frames, max_frames) : frames;
+    return view;
+  }
+};
+
+// Format of the -input file: -input-format, else the extension or the RIFF
+// magic
+std::string inputFormat(const Options &opts, const MappedFile &file) {
+  if (opts.input_format != "auto") {
+    return opts.input_format;
+  }
+  std::string ext;
+  size_t dot = opts.input_file.rfind('.');
+  if (dot != std::string::npos) {
+    ext = opts.input_file.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+  }
+  if (ext == "wav" || ext == "wave" ||
+      (file.size() >= 12 && memcmp(file.data(), "RIFF", 4) == 0)) {
+    return "wav";
+  }
+  if (ext == "f32" || ext == "s16") {
+    return ext;
+  }
+  return "";
+}
+
+uint16_t readLE16(const unsigned char *p) {
+  return (uint16_t)(p[0] | p[1] << 8);
+}
+
+uint32_t readLE32(const unsigned char *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+// Locate the fmt and data chunks of a WAV file
+bool parseWav(AudioFile &audio, const std::string &path,
+              std::string &error_msg) {
+  const unsigned char *bytes = audio.file.data();
+  size_t size = audio.file.size();
+  if (size < 12 || memcmp(bytes, "RIFF", 4) != 0 ||
+      memcmp(bytes + 8, "WAVE", 4) != 0) {
+    error_msg = "Error: " + path + " is not a WAV file";
+    return false;
+  }
+
+  int format = 0;
+  int bits = 0;
+  bool have_fmt = false;
+  for (size_t pos = 12; pos + 8 <= size;) {
+    const unsigned char *chunk = bytes + pos;
+    uint32_t chunk_size = readLE32(chunk + 4);
+    size_t body = pos + 8;
+
+    if (memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16 &&
+        body + 16 <= size) {
+      format = readLE16(bytes + body);
+      audio.channels = readLE16(bytes + body + 2);
+      audio.sample_rate = (int)readLE32(bytes + body + 4);
+      bits = readLE16(bytes + body + 14);
+      // WAVE_FORMAT_EXTENSIBLE: the format is the start of the subformat GUID
+      if (format == 0xFFFE && chunk_size >= 40 && body + 26 <= size) {
+        format = readLE16(bytes + body + 24);
+      }
+      have_fmt = true;
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      if (!have_fmt) {
+        break;
+      }
+      // Writers that never went back to fill in the size leave 0 or ~0
+      size_t data_size = std::min<size_t>(chunk_size, size - body);
+      if (chunk_size == 0) {
+        data_size = size - body;
+      }
+      audio.samples = bytes + body;
+
+      if (format == 3 && bits == 32) {
+        audio.encoding = AudioView::Float32;
+      } else if (format == 3 && bits == 64) {
+        audio.encoding = AudioView::Float64;
+      } else if (format == 1 && bits == 16) {
+        audio.encoding = AudioView::Int16;
+      } else if (format == 1 && bits == 24) {
+        audio.encoding = AudioView::Int24;
+      } else {
+        std::ostringstream oss;
+        oss << "Error: " << path << ": unsupported WAV encoding (format "
+            << format << ", " << bits
+            << " bits), use 16/24-bit PCM or 32/64-bit float";
+        error_msg = oss.str();
+        return false;
+      }
+      if (audio.channels <= 0 || audio.sample_rate <= 0) {
+        error_msg = "Error: " + path + ": invalid WAV header";
+        return false;
+      }
+      audio.frames = (int64_t)(data_size / ((size_t)audio.channels *
+                                            AudioView::bytesPerSample(
+                                                audio.encoding)));
+      return true;
+    }
+    pos = body + chunk_size + (chunk_size & 1);
+  }
+
+  error_msg = "Error: " + path + ": no audio data found";
+  return false;
+}
+
+// Map the -input file and work out its layout
+bool openAudioFile(const Options &opts, AudioFile &audio,
+                   std::string &error_msg) {
+  if (!audio.file.open(opts.input_file, error_msg)) {
+    return false;
+  }
+
+  std::string format = inputFormat(opts, audio.file);
+  if (format == "wav") {
+    return parseWav(audio, opts.input_file, error_msg);
+  }
+  if (format != "f32" && format != "s16") {
+    error_msg = "Error: Unknown format of " + opts.input_file +
+                ", use -input-format wav|f32|s16";
+    return false;
+  }
+
+  audio.encoding = (format == "f32") ? AudioView::Float32 : AudioView::Int16;
+  audio.channels = opts.input_channels;
+  audio.sample_rate = opts.sample_rate;
+  audio.samples = audio.file.data();
+  audio.frames = (int64_t)(audio.file.size() /
+                           ((size_t)audio.channels *
+                            AudioView::bytesPerSample(audio.encoding)));
+  return true;
+}
+
+// Block reader over the captured channels of a file, with the interface of
+// SynthEngine so the streaming pipeline can take either
+class AudioFileReader {
+public:
+  static const char *const kStage; // Profile stage of render()
+
+private:
+  std::vector<AudioView> channels_;
+  int64_t num_samples_;
+  int block_size_;
+  int64_t position_;
+
+public:
+  AudioFileReader(const std::vector<AudioView> &channels, int64_t num_samples,
+                  const Options &opts)
+      : channels_(channels), num_samples_(num_samples),
+        block_size_(std::max(1, opts.block_size)), position_(0) {}
+
+  int64_t numSamples() const { return num_samples_; }
+  bool done() const { return position_ >= num_samples_; }
+
+  int render(Sample *const *dst, int n_dst, int max_count) {
+    int count = (int)std::min<int64_t>(std::min(max_count, block_size_),
+                                       num_samples_ - position_);
+    for (int c = 0; c < n_dst; c++) {
+      channels_[c].read(position_, count, dst[c]);
+    }
+    position_ += count;
+    return count;
+  }
+};
+
+const char *const AudioFileReader::kStage = "read";
+
+// Compute a mixed signal over whole views, a block at a time
+void mixSignal(const SignalSource &source,
+               const std::vector<AudioView> &channels, int64_t count,
+               Sample *out) {
+  const int kChunk = 65536;
+  std::vector<Sample> buffer((size_t)kChunk * channels.size());
+  std::vector<const Sample *> blocks(channels.size());
+  for (size_t c = 0; c < channels.size(); c++) {
+    blocks[c] = &buffer[c * kChunk];
+  }
+
+  for (int64_t pos = 0; pos < count; pos += kChunk) {
+    int n = (int)std::min<int64_t>(kChunk, count - pos);
+    for (size_t c = 0; c < channels.size(); c++) {
+      channels[c].read(pos, n, &buffer[c * kChunk]);
+    }
+    mixSignal(source, &blocks[0], (int)channels.size(), n, out + pos);
+  }
+}
+
+//==============================================================================
+// Spectral Kernels
+//==============================================================================
+
+// The per-bin loops of the analysis (magnitude or power of every FFT output,
+// dB conversion of every mel value) come in one version per instruction set.
+// The best version the CPU supports is picked once at startup. Spectrum
+// kernels exist for float and double FFT output and always write float; the
+// table holds the ones for the build's Sample type.
+
+typedef void (*SpectrumKernel)(const SampleComplex *in, int n_bins,
+                               float *out);
+
+// Fast dB conversion: out = factor * log10(x), clamped below at db_min, and
+// db_min for x <= 0
+typedef void (*DbKernel)(float *values, int count, float factor,
+                         float db_min);
+
+struct SpectralKernels {
+  const char *name;
+  SpectrumKernel magnitude;
+  SpectrumKernel power;
+  DbKernel fast_db;
+};
+
+template <typename Real>
+void magnitudeScalar(const Real (*in)[2], int n_bins, float *out) {
+  for (int i = 0; i < n_bins; i++) {
+    Real real = in[i][0];
+    Real imag = in[i][1];
+    out[i] = (float)std::sqrt(real * real + imag * imag);
+  }
+}
+
+template <typename Real>
+void powerScalar(const Real (*in)[2], int n_bins, float *out) {
+  for (int i = 0; i < n_bins; i++) {
+    Real real = in[i][0];
+    Real imag = in[i][1];
+    out[i] = (float)(real * real + imag * imag);
+  }
+}
+
+// Approximate log2 shared by every fast dB kernel. x = 2^e * m with m
+// folded into [sqrt(1/2), sqrt(2)), then log2(m) = 2/ln(2) * atanh(t) with
+// t = (m - 1) / (m + 1), |t| < 0.172, from the series up to t^7 (truncation
+// below 5e-8). Against a double precision reference the result is within
+// 2e-4 dB over the whole float range (measured for factor 20; denormal
+// inputs are treated as FLT_MIN).
+const float kLog2Series[4] = {2.885390082f, 0.961796694f, 0.577078016f,
+                              0.412198583f};
+
+inline float fastDbScalar(float x, float scale, float db_min) {
+  if (!(x > 0)) {
+    return db_min;
+  }
+  uint32_t bits;
+  float clamped = std::max(x, FLT_MIN);
+  memcpy(&bits, &clamped, sizeof(bits));
+  int e = (int)(bits >> 23) - 127;
+  bits = (bits & 0x007FFFFF) | 0x3F800000;
+  float m;
+  memcpy(&m, &bits, sizeof(m));
+  if (m > 1.41421356f) {
+    m *= 0.5f;
+    e += 1;
+  }
+  float t = (m - 1.0f) / (m + 1.0f);
+  float t2 = t * t;
+  float p = t * (kLog2Series[0] +
+                 t2 * (kLog2Series[1] +
+                       t2 * (kLog2Series[2] + t2 * kLog2Series[3])));
+  return std::max(scale * ((float)e + p), db_min);
+}
+
+// factor * log10(x) = factor * log10(2) * log2(x)
+const float kLog10Of2 = 0.30102999566f;
+
+void fastDbScalarKernel(float *values, int count, float factor,
+                        float db_min) {
+  const float scale = factor * kLog10Of2;
+  for (int i = 0; i < count; i++) {
+    values[i] = fastDbScalar(values[i], scale, db_min);
+  }
+}
+
+const SpectralKernels kScalarKernels = {"scalar", magnitudeScalar<Sample>,
+                                        powerScalar<Sample>,
+                                        fastDbScalarKernel};
+
+#ifdef SPECTROGRAM_X86_KERNELS
+
+//------------------------------------------------------------------------------
+// SSE2: 4 bins per iteration
+//------------------------------------------------------------------------------
+
+// Double precision spectra are computed in double, like the scalar version,
+// and rounded to float once at the end
+template <bool Sqrt>
+__attribute__((target("sse2"))) void
+spectrumSSE2(const fftw_complex *in, int n_bins, float *out) {
+  int i = 0;
+  for (; i + 4 <= n_bins; i += 4) {
+    __m128d a = _mm_loadu_pd(&in[i][0]); // r0 i0
+    __m128d b = _mm_loadu_pd(&in[i + 1][0]);
+    __m128d c = _mm_loadu_pd(&in[i + 2][0]);
+    __m128d d = _mm_loadu_pd(&in[i + 3][0]);
+    a = _mm_mul_pd(a, a);
+    b = _mm_mul_pd(b, b);
+    c = _mm_mul_pd(c, c);
+    d = _mm_mul_pd(d, d);
+    __m128d lo = _mm_add_pd(_mm_unpacklo_pd(a, b), _mm_unpackhi_pd(a, b));
+    __m128d hi = _mm_add_pd(_mm_unpacklo_pd(c, d), _mm_unpackhi_pd(c, d));
+    if (Sqrt) {
+      lo = _mm_sqrt_pd(lo);
+      hi = _mm_sqrt_pd(hi);
+    }
+    _mm_storeu_ps(out + i, _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi)));
+  }
+  Sqrt ? magnitudeScalar(in + i, n_bins - i, out + i)
+       : powerScalar(in + i, n_bins - i, out + i);
+}
+
+template <bool Sqrt>
+__attribute__((target("sse2"))) void
+spectrumSSE2(const fftwf_complex *in, int n_bins, float *out) {
+  int i = 0;
+  for (; i + 4 <= n_bins; i += 4) {
+    __m128 a = _mm_loadu_ps(&in[i][0]); // r0 i0 r1 i1
+    __m128 b = _mm_loadu_ps(&in[i + 2][0]);
+    a = _mm_mul_ps(a, a);
+    b = _mm_mul_ps(b, b);
+    __m128 re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+    __m128 sum = _mm_add_ps(re, im);
+    _mm_storeu_ps(out + i, Sqrt ? _mm_sqrt_ps(sum) : sum);
+  }
+  Sqrt ? magnitudeScalar(in + i, n_bins - i, out + i)
+       : powerScalar(in + i, n_bins - i, out + i);
+}
+
+__attribute__((target("sse2"))) void fastDbSSE2(float *values, int count,
+                                                float factor, float db_min) {
+  const float scale = factor * kLog10Of2;
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 sqrt2 = _mm_set1_ps(1.41421356f);
+  const __m128 vmin = _mm_set1_ps(FLT_MIN);
+  const __m128 vscale = _mm_set1_ps(scale);
+  const __m128 vdb_min = _mm_set1_ps(db_min);
+  const __m128i mantissa = _mm_set1_epi32(0x007FFFFF);
+  const __m128i exponent_one = _mm_set1_epi32(0x3F800000);
+  const __m128i bias = _mm_set1_epi32(127);
+
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 x = _mm_loadu_ps(values + i);
+    __m128 positive = _mm_cmpgt_ps(x, zero);
+    __m128i bits = _mm_castps_si128(_mm_max_ps(x, vmin));
+    __m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), bias));
+    __m128 m = _mm_castsi128_ps(
+        _mm_or_si128(_mm_and_si128(bits, mantissa), exponent_one));
+    __m128 big = _mm_cmpgt_ps(m, sqrt2);
+    m = _mm_or_ps(_mm_and_ps(big, _mm_mul_ps(m, half)), _mm_andnot_ps(big, m));
+    e = _mm_add_ps(e, _mm_and_ps(big, one));
+
+    __m128 t = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+    __m128 t2 = _mm_mul_ps(t, t);
+    __m128 p = _mm_set1_ps(kLog2Series[3]);
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(kLog2Series[2]));
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(kLog2Series[1]));
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(kLog2Series[0]));
+    p = _mm_mul_ps(p, t);
+
+    __m128 db = _mm_max_ps(_mm_mul_ps(vscale, _mm_add_ps(e, p)), vdb_min);
+    db = _mm_or_ps(_mm_and_ps(positive, db), _mm_andnot_ps(positive, vdb_min));
+    _mm_storeu_ps(values + i, db);
+  }
+  fastDbScalarKernel(values + i, count - i, factor, db_min);
+}
+
+//------------------------------------------------------------------------------
+// AVX2: 8 bins per iteration
+//------------------------------------------------------------------------------
+
+template <bool Sqrt>
+__attribute__((target("avx2"))) void
+spectrumAVX2(const fftwf_complex *in, int n_bins, float *out) {
+  int i = 0;
+  for (; i + 8 <= n_bins; i += 8) {
+    __m256 a = _mm256_loadu_ps(&in[i][0]); // bins 0-3
+    __m256 b = _mm256_loadu_ps(&in[i + 4][0]); // bins 4-7
+    a = _mm256_mul_ps(a, a);
+    b = _mm256_mul_ps(b, b);
+    // Pairwise sums come out as bins 0 1 4 5 | 2 3 6 7
+    __m256 sum = _mm256_hadd_ps(a, b);
+    sum = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(sum),
+                                                 _MM_SHUFFLE(3, 1, 2, 0)));
+    _mm256_storeu_ps(out + i, Sqrt ? _mm256_sqrt_ps(sum) : sum);
+  }
+  spectrumSSE2<Sqrt>(in + i, n_bins - i, out + i);
+}
+
+template <bool Sqrt>
+__attribute__((target("avx2"))) void
+spectrumAVX2(const fftw_complex *in, int n_bins, float *out) {
+  int i = 0;
+  for (; i + 4 <= n_bins; i += 4) {
+    __m256d a = _mm256_loadu_pd(&in[i][0]); // bins 0-1
+    __m256d b = _mm256_loadu_pd(&in[i + 2][0]); // bins 2-3
+    a = _mm256_mul_pd(a, a);
+    b = _mm256_mul_pd(b, b);
+    // Pairwise sums come out as bins 0 2 1 3
+    __m256d sum = _mm256_hadd_pd(a, b);
+    sum = _mm256_permute4x64_pd(sum, _MM_SHUFFLE(3, 1, 2, 0));
+    _mm_storeu_ps(out + i, _mm256_cvtpd_ps(Sqrt ? _mm256_sqrt_pd(sum) : sum));
+  }
+  spectrumSSE2<Sqrt>(in + i, n_bins - i, out + i);
+}
+
+__attribute__((target("avx2"))) void fastDbAVX2(float *values, int count,
+                                                float factor, float db_min) {
+  const float scale = factor * kLog10Of2;
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256 sqrt2 = _mm256_set1_ps(1.41421356f);
+  const __m256 vmin = _mm256_set1_ps(FLT_MIN);
+  const __m256 vscale = _mm256_set1_ps(scale);
+  const __m256 vdb_min = _mm256_set1_ps(db_min);
+  const __m256i mantissa = _mm256_set1_epi32(0x007FFFFF);
+  const __m256i exponent_one = _mm256_set1_epi32(0x3F800000);
+  const __m256i bias = _mm256_set1_epi32(127);
+
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 x = _mm256_loadu_ps(values + i);
+    __m256 positive = _mm256_cmp_ps(x, zero, _CMP_GT_OQ);
+    __m256i bits = _mm256_castps_si256(_mm256_max_ps(x, vmin));
+    __m256 e = _mm256_cvtepi32_ps(
+        _mm256_sub_epi32(_mm256_srli_epi32(bits, 23), bias));
+    __m256 m = _mm256_castsi256_ps(
+        _mm256_or_si256(_mm256_and_si256(bits, mantissa), exponent_one));
+    __m256 big = _mm256_cmp_ps(m, sqrt2, _CMP_GT_OQ);
+    m = _mm256_blendv_ps(m, _mm256_mul_ps(m, half), big);
+    e = _mm256_add_ps(e, _mm256_and_ps(big, one));
+
+    __m256 t = _mm256_div_ps(_mm256_sub_ps(m, one), _mm256_add_ps(m, one));
+    __m256 t2 = _mm256_mul_ps(t, t);
+    __m256 p = _mm256_set1_ps(kLog2Series[3]);
+    p = _mm256_add_ps(_mm256_mul_ps(p, t2), _mm256_set1_ps(kLog2Series[2]));
+    p = _mm256_add_ps(_mm256_mul_ps(p, t2), _mm256_set1_ps(kLog2Series[1]));
+    p = _mm256_add_ps(_mm256_mul_ps(p, t2), _mm256_set1_ps(kLog2Series[0]));
+    p = _mm256_mul_ps(p, t);
+
+    __m256 db =
+        _mm256_max_ps(_mm256_mul_ps(vscale, _mm256_add_ps(e, p)), vdb_min);
+    _mm256_storeu_ps(values + i, _mm256_blendv_ps(vdb_min, db, positive));
+  }
+  fastDbSSE2(values + i, count - i, factor, db_min);
+}
+
+//------------------------------------------------------------------------------
+// AVX-512: 16 bins per iteration
+//------------------------------------------------------------------------------
+
+// GCC 12's AVX-512 headers trip -Wmaybe-uninitialized on their own
+// _mm512_undefined_* placeholders
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+template <bool Sqrt>
+__attribute__((target("avx512f"))) void
+spectrumAVX512(const fftwf_complex *in, int n_bins, float *out) {
+  const __m512i even = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18,
+                                         20, 22, 24, 26, 28, 30);
+  const __m512i odd = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19,
+                                        21, 23, 25, 27, 29, 31);
+  int i = 0;
+  for (; i + 16 <= n_bins; i += 16) {
+    __m512 a = _mm512_loadu_ps(&in[i][0]); // bins 0-7
+    __m512 b = _mm512_loadu_ps(&in[i + 8][0]); // bins 8-15
+    a = _mm512_mul_ps(a, a);
+    b = _mm512_mul_ps(b, b);
+    __m512 re = _mm512_permutex2var_ps(a, even, b);
+    __m512 im = _mm512_permutex2var_ps(a, odd, b);
+    __m512 sum = _mm512_add_ps(re, im);
+    _mm512_storeu_ps(out + i, Sqrt ? _mm512_sqrt_ps(sum) : sum);
+  }
+  spectrumSSE2<Sqrt>(in + i, n_bins - i, out + i);
+}
+
+template <bool Sqrt>
+__attribute__((target("avx512f"))) void
+spectrumAVX512(const fftw_complex *in, int n_bins, float *out) {
+  const __m512i even = _mm512_setr_epi64(0, 2, 4, 6, 8, 10, 12, 14);
+  const __m512i odd = _mm512_setr_epi64(1, 3, 5, 7, 9, 11, 13, 15);
+  int i = 0;
+  for (; i + 8 <= n_bins; i += 8) {
+    __m512d a = _mm512_loadu_pd(&in[i][0]); // bins 0-3
+    __m512d b = _mm512_loadu_pd(&in[i + 4][0]); // bins 4-7
+    a = _mm512_mul_pd(a, a);
+    b = _mm512_mul_pd(b, b);
+    __m512d re = _mm512_permutex2var_pd(a, even, b);
+    __m512d im = _mm512_permutex2var_pd(a, odd, b);
+    __m512d sum = _mm512_add_pd(re, im);
+    _mm256_storeu_ps(out + i,
+                     _mm512_cvtpd_ps(Sqrt ? _mm512_sqrt_pd(sum) : sum));
+  }
+  spectrumSSE2<Sqrt>(in + i, n_bins - i, out + i);
+}
+
+__attribute__((target("avx512f"))) void
+fastDbAVX512(float *values, int count, float factor, float db_min) {
+  const float scale = factor * kLog10Of2;
+  const __m512 zero = _mm512_setzero_ps();
+  const __m512 one = _mm512_set1_ps(1.0f);
+  const __m512 half = _mm512_set1_ps(0.5f);
+  const __m512 sqrt2 = _mm512_set1_ps(1.41421356f);
+  const __m512 vmin = _mm512_set1_ps(FLT_MIN);
+  const __m512 vscale = _mm512_set1_ps(scale);
+  const __m512 vdb_min = _mm512_set1_ps(db_min);
+  const __m512i mantissa = _mm512_set1_epi32(0x007FFFFF);
+  const __m512i exponent_one = _mm512_set1_epi32(0x3F800000);
+  const __m512i bias = _mm512_set1_epi32(127);
+
+  int i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m512 x = _mm512_loadu_ps(values + i);
+    __mmask16 positive = _mm512_cmp_ps_mask(x, zero, _CMP_GT_OQ);
+    __m512i bits = _mm512_castps_si512(_mm512_max_ps(x, vmin));
+    __m512 e = _mm512_cvtepi32_ps(
+        _mm512_sub_epi32(_mm512_srli_epi32(bits, 23), bias));
+    __m512 m = _mm512_castsi512_ps(
+        _mm512_or_si512(_mm512_and_si512(bits, mantissa), exponent_one));
+    __mmask16 big = _mm512_cmp_ps_mask(m, sqrt2, _CMP_GT_OQ);
+    m = _mm512_mask_mul_ps(m, big, m, half);
+    e = _mm512_mask_add_ps(e, big, e, one);
+
+    __m512 t = _mm512_div_ps(_mm512_sub_ps(m, one), _mm512_add_ps(m, one));
+    __m512 t2 = _mm512_mul_ps(t, t);
+    __m512 p = _mm512_set1_ps(kLog2Series[3]);
+    p = _mm512_add_ps(_mm512_mul_ps(p, t2), _mm512_set1_ps(kLog2Series[2]));
+    p = _mm512_add_ps(_mm512_mul_ps(p, t2), _mm512_set1_ps(kLog2Series[1]));
+    p = _mm512_add_ps(_mm512_mul_ps(p, t2), _mm512_set1_ps(kLog2Series[0]));
+    p = _mm512_mul_ps(p, t);
+
+    __m512 db =
+        _mm512_max_ps(_mm512_mul_ps(vscale, _mm512_add_ps(e, p)), vdb_min);
+    _mm512_storeu_ps(values + i, _mm512_mask_blend_ps(positive, vdb_min, db));
+  }
+  fastDbSSE2(values + i, count - i, factor, db_min);
+}
+
+#pragma GCC diagnostic pop
+
+const SpectralKernels kSSE2Kernels = {"sse2", spectrumSSE2<true>,
+                                      spectrumSSE2<false>, fastDbSSE2};
+const SpectralKernels kAVX2Kernels = {"avx2", spectrumAVX2<true>,
+                                      spectrumAVX2<false>, fastDbAVX2};
+const SpectralKernels kAVX512Kernels = {"avx512", spectrumAVX512<true>,
+                                        spectrumAVX512<false>, fastDbAVX512};
+
+#endif // SPECTROGRAM_X86_KERNELS
+
+// Kernel set for isa (auto, scalar, sse2, avx2, avx512), or nullptr if this
+// CPU or build does not have it
+const SpectralKernels *findKernels(const std::string &isa) {
+#ifdef SPECTROGRAM_X86_KERNELS
+  __builtin_cpu_init();
+  bool avx512 = __builtin_cpu_supports("avx512f");
+  bool avx2 = __builtin_cpu_supports("avx2");
+  bool sse2 = __builtin_cpu_supports("sse2");
+  if (isa == "avx512" || (isa == "auto" && avx512)) {
+    return avx512 ? &kAVX512Kernels : nullptr;
+  } else if (isa == "avx2" || (isa == "auto" && avx2)) {
+    return avx2 ? &kAVX2Kernels : nullptr;
+  } else if (isa == "sse2" || (isa == "auto" && sse2)) {
+    return sse2 ? &kSSE2Kernels : nullptr;
+  }
+#endif
+  return (isa == "auto" || isa == "scalar") ? &kScalarKernels : nullptr;
+}
+
+const SpectralKernels *&activeKernels() {
+  static const SpectralKernels *kernels = findKernels("auto");
+  return kernels;
+}
+
+// Kernels used by the analysis. Selected once from main, before any worker
+// thread starts.
+const SpectralKernels &spectralKernels() { return *activeKernels(); }
+
+void selectKernels(const std::string &isa) {
+  const SpectralKernels *kernels = findKernels(isa);
+  if (kernels == nullptr) {
+    std::cerr << "Warning: " << isa
+              << " kernels are not available on this machine, using auto"
+              << std::endl;
+    kernels = findKernels("auto");
+  }
+  activeKernels() = kernels;
+}
+
+// Convert count values to dB scale in place: factor * log10 (20 for
+// magnitudes, 10 for powers), clamped below at db_min. The exact version
+// calls log10 per value; the fast one is vectorized (error < 2e-4 dB).
+void convertRowToDb(float *row, int count, float db_min, float factor,
+                    bool fast) {
+  if (fast) {
+    spectralKernels().fast_db(row, count, factor, db_min);
+    return;
+  }
+  for (int i = 0; i < count; i++) {
+    float &val = row[i];
+    if (val > 0) {
+      val = factor * std::log10(val);
+      val = std::max(val, db_min);
+    } else {
+      val = db_min;
+    }
+  }
+}
+
+// dB factor for the spectrum type
+float dbFactor(const Options &opts) { return opts.power ? 10.0f : 20.0f; }
+
+//==============================================================================
+// Numeric Export
+//==============================================================================
+
+
+// Writer for -export. The header is written first with the final shape, then
+// rows are appended in order, so linear frames can be streamed out as they
+// are computed. Data always starts at a 64-byte aligned offset and is stored
+// row-major without padding, so readers can map the file with zero copies.
+//
+// "<file>.npy": NumPy format 1.0, dtype float32, shape (frames, bins).
+// Any other name: raw float32 after this 64-byte header (native byte order,
+// header_size doubles as a byte order check):
+//
+//   0  char[8]  "FSPECF32"          32  uint32  sample_rate
+//   8  uint32   header_size (64)     36  uint32  hop_size
+//   12 uint32   flags (1 mel, 2 dB)  40  uint32  fft_size
+//   16 uint64   rows (frames)        44  float32 fmin
+//   24 uint64   cols (bins)          48  float32 fmax, then zero padding
+//
+// Flag 4 marks power rather than magnitude values (-power).
+class MatrixExport {
+private:
+  FILE *fp_;
+  int64_t rows_;
+  int cols_;
+  int64_t written_;
+  float db_min_;
+  float db_factor_;
+  bool use_db_;
+  bool fast_db_;
+  std::vector<float> scratch_;
+
+  static bool isLittleEndian() {
+    const uint16_t probe = 1;
+    return *(const unsigned char *)&probe == 1;
+  }
+
+  bool writeNpyHeader() {
+    std::ostringstream dict;
+    dict << "{'descr': '" << (isLittleEndian() ? '<' : '>')
+         << "f4', 'fortran_order': False, 'shape': (" << rows_ << ", "
+         << cols_ << "), }";
+    std::string header = dict.str();
+
+    // Magic (6) + version (2) + length (2) + dict, padded with spaces and
+    // ended by a newline to a multiple of 64
+    size_t total = (10 + header.size() + 1 + 63) / 64 * 64;
+    header.append(total - 10 - header.size() - 1, ' ');
+    header += '\n';
+
+    unsigned char preamble[10] = {0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0};
+    preamble[8] = (unsigned char)(header.size() & 0xFF);
+    preamble[9] = (unsigned char)(header.size() >> 8);
+    return fwrite(preamble, 1, 10, fp_) == 10 &&
+           fwrite(header.data(), 1, header.size(), fp_) == header.size();
+  }
+
+  bool writeRawHeader(const Options &opts, bool mel) {
+    unsigned char header[64];
+    memset(header, 0, sizeof(header));
+    uint32_t header_size = sizeof(header);
+    uint32_t flags =
+        (mel ? 1 : 0) | (opts.use_db ? 2 : 0) | (opts.power ? 4 : 0);
+    uint64_t rows = rows_;
+    uint64_t cols = cols_;
+    uint32_t sample_rate = opts.sample_rate;
+    uint32_t hop_size = opts.hop_size;
+    uint32_t fft_size = opts.fft_size;
+    float fmin = opts.fmin;
+    float fmax = opts.fmax;
+
+    memcpy(header, "FSPECF32", 8);
+    memcpy(header + 8, &header_size, 4);
+    memcpy(header + 12, &flags, 4);
+    memcpy(header + 16, &rows, 8);
+    memcpy(header + 24, &cols, 8);
+    memcpy(header + 32, &sample_rate, 4);
+    memcpy(header + 36, &hop_size, 4);
+    memcpy(header + 40, &fft_size, 4);
+    memcpy(header + 44, &fmin, 4);
+    memcpy(header + 48, &fmax, 4);
+    return fwrite(header, 1, sizeof(header), fp_) == sizeof(header);
+  }
+
+public:
+  MatrixExport()
+      : fp_(nullptr), rows_(0), cols_(0), written_(0), db_min_(0),
+        db_factor_(20.0f), use_db_(false), fast_db_(false) {}
+  ~MatrixExport() { close(); }
+
+  // mel tells which matrix is exported (recorded in the raw header). With
+  // convert_db rows are converted to dB as they are written.
+  bool open(const std::string &path, int64_t rows, int cols,
+            const Options &opts, bool mel, bool convert_db) {
+    rows_ = rows;
+    cols_ = cols;
+    written_ = 0;
+    use_db_ = convert_db;
+    db_min_ = opts.db_min;
+    db_factor_ = dbFactor(opts);
+    fast_db_ = opts.fast_log;
+    scratch_.resize(convert_db ? cols : 0);
+
+    fp_ = fopen(path.c_str(), "wb");
+    if (!fp_) {
+      std::cerr << "Error: Could not open file " << path << std::endl;
+      return false;
+    }
+
+    bool npy = path.size() > 4 && path.substr(path.size() - 4) == ".npy";
+    if (!(npy ? writeNpyHeader() : writeRawHeader(opts, mel))) {
+      std::cerr << "Error: Could not write " << path << std::endl;
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  bool writeRow(const float *row) {
+    if (use_db_) {
+      std::copy(row, row + cols_, scratch_.begin());
+      convertRowToDb(&scratch_[0], cols_, db_min_, db_factor_, fast_db_);
+      row = &scratch_[0];
+    }
+    written_++;
+    return fwrite(row, sizeof(float), cols_, fp_) == (size_t)cols_;
+  }
+
+  bool writeMatrix(const Matrix<float> &matrix) {
+    for (int r = 0; r < matrix.rows(); r++) {
+      if (!writeRow(matrix.row(r))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Returns false if the file could not be completed
+  bool close() {
+    if (!fp_) {
+      return false;
+    }
+    bool ok = (written_ == rows_) && fclose(fp_) == 0;
+    fp_ = nullptr;
+    return ok;
+  }
+
+private:
+  MatrixExport(const MatrixExport &);
+  MatrixExport &operator=(const MatrixExport &);
+};
+
+//==============================================================================
+// DSP and Signal Processing Functions
+//==============================================================================
+
+// Window functions. Each shape is a policy evaluated at x in [0, 1];
+// createWindow resolves the name once and tabulates the chosen shape.
+struct HannWindow {
+  template <typename Real> static Real at(Real x) {
+    return Real(0.5) * (Real(1) - std::cos(2.0 * M_PI * x));
+  }
+};
+
+struct HammingWindow {
+  template <typename Real> static Real at(Real x) {
+    return Real(0.54) - Real(0.46) * std::cos(2.0 * M_PI * x);
+  }
+};
+
+struct BlackmanWindow {
+  template <typename Real> static Real at(Real x) {
+    return Real(0.42) - Real(0.5) * std::cos(2.0 * M_PI * x) +
+           Real(0.08) * std::cos(4.0 * M_PI * x);
+  }
+};
+
+struct RectangularWindow {
+  template <typename Real> static Real at(Real) { return Real(1); }
+};
+
+template <typename Real, typename Window>
+std::vector<Real> fillWindow(int size) {
+  std::vector<Real> window(size);
+  for (int i = 0; i < size; i++) {
+    Real x = (Real)i / (size - 1);
+    window[i] = Window::at(x);
+  }
+  return window;
+}
+
+template <typename Real>
+std::vector<Real> createWindow(int size, const std::string &type) {
+  if (type == "hann") {
+    return fillWindow<Real, HannWindow>(size);
+  } else if (type == "hamming") {
+    return fillWindow<Real, HammingWindow>(size);
+  } else if (type == "blackman") {
+    return fillWindow<Real, BlackmanWindow>(size);
+  }
+  return fillWindow<Real, RectangularWindow>(size);
+}
+
+// Hz to Mel conversion
+float hzToMel(float hz) { return 2595.0f * std::log10(1.0f + hz / 700.0f); }
+
+// Mel to Hz conversion
+float melToHz(float mel) {
+  return 700.0f * (std::pow(10.0f, mel / 2595.0f) - 1.0f);
+}
+
+// Sparse triangular mel filterbank. Band i only covers FFT bins
+// [start[i], end[i]), and its weights are stored contiguously in weights
+// from offset[i], so projection never touches the zeros outside a triangle.
+struct MelFilterbank {
+  int n_mels;
+  int n_bins;
+  std::vector<int> start;
+  std::vector<int> end;
+  std::vector<int> offset;
+  std::vector<float> weights;
+
+  MelFilterbank() : n_mels(0), n_bins(0) {}
+};
+
+// Create mel filterbank
+MelFilterbank createMelFilterbank(int n_mels, int fft_size, int sample_rate,
+                                  float fmin, float fmax) {
+
+  // Convert to mel scale
+  float mel_min = hzToMel(fmin);
+  float mel_max = hzToMel(fmax);
+
+  // Create mel points (n_mels + 2 for edges)
+  std::vector<float> mel_points(n_mels + 2);
+  for (int i = 0; i < n_mels + 2; i++) {
+    mel_points[i] = mel_min + (mel_max - mel_min) * i / (n_mels + 1);
+  }
+
+  // Convert mel points to Hz then to FFT bins
+  std::vector<int> bin_points(n_mels + 2);
+  int n_fft_bins = fft_size / 2 + 1;
+  for (int i = 0; i < n_mels + 2; i++) {
+    float hz = melToHz(mel_points[i]);
+    bin_points[i] = (int)std::floor((fft_size + 1) * hz / sample_rate);
+  }
+
+  // Create triangular filters
+  MelFilterbank filterbank;
+  filterbank.n_mels = n_mels;
+  filterbank.n_bins = n_fft_bins;
+  filterbank.start.resize(n_mels);
+  filterbank.end.resize(n_mels);
+  filterbank.offset.resize(n_mels);
+
+  for (int i = 0; i < n_mels; i++) {
+    int left = bin_points[i];
+    int center = bin_points[i + 1];
+    int right = bin_points[i + 2];
+
+    // Clip the triangle to the FFT bins that exist
+    int first = std::max(0, left);
+    int last = std::min(right, n_fft_bins);
+    filterbank.start[i] = first;
+    filterbank.end[i] = std::max(first, last);
+    filterbank.offset[i] = filterbank.weights.size();
+
+    for (int j = first; j < last; j++) {
+      if (j < center) {
+        // Rising slope
+        filterbank.weights.push_back((float)(j - left) / (center - left));
+      } else {
+        // Falling slope
+        filterbank.weights.push_back((float)(right - j) / (right - center));
+      }
+    }
+  }
+
+  return filterbank;
+}
+
+// Number of complete STFT frames in a signal of num_samples samples
+int countFrames(int64_t num_samples, int fft_size, int hop_size) {
+  if (num_samples < fft_size) {
+    return 0;
+  }
+  return (int)((num_samples - fft_size) / hop_size + 1);
+}
+
+// Project one magnitude frame onto the mel filterbank, looping only over
+// the non-zero range of each triangle
+void applyMelFilterbankFrame(const float *RESTRICT magnitude,
+                             const MelFilterbank &filterbank,
+                             float *RESTRICT mel_frame) {
+  const float *weights = filterbank.weights.data();
+
+  for (int mel = 0; mel < filterbank.n_mels; mel++) {
+    const float *w = weights + filterbank.offset[mel];
+    const float *m = magnitude + filterbank.start[mel];
+    int width = filterbank.end[mel] - filterbank.start[mel];
+    float sum = 0.0f;
+    for (int i = 0; i < width; i++) {
+      sum += m[i] * w[i];
+    }
+    mel_frame[mel] = sum;
+  }
+}
+
+// Running minimum and maximum of a set of values
+struct ValueRange {
+  float min;
+  float max;
+
+  ValueRange() : min(1e10f), max(-1e10f) {}
+
+  void update(const float *values, int count) {
+    float lo = min;
+    float hi = max;
+    for (int i = 0; i < count; i++) {
+      lo = std::min(lo, values[i]);
+      hi = std::max(hi, values[i]);
+    }
+    min = lo;
+    max = hi;
+  }
+
+  void merge(const ValueRange &other) {
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+  }
+};
+
+// Post-processing of each mel frame, applied as soon as the frame is
+// produced and still in cache: dB conversion when requested, and the running
+// range that automatic normalization needs. This saves separate passes over
+// the whole spectrogram.
+class FrameFinisher {
+private:
+  bool use_db_;
+  float db_min_;
+  float db_factor_;
+  bool fast_db_;
+
+public:
+  ValueRange range;
+
+  explicit FrameFinisher(const Options &opts)
+      : use_db_(opts.use_db), db_min_(opts.db_min), db_factor_(dbFactor(opts)),
+        fast_db_(opts.fast_log) {}
+
+  void operator()(float *frame, int count) {
+    if (use_db_) {
+      convertRowToDb(frame, count, db_min_, db_factor_, fast_db_);
+    }
+    range.update(frame, count);
+  }
+};
+
+// Spectra of frames [begin, end) on the calling thread. The worker owns its
+// input/output buffers and runs the shared batched plan through the
+// new-array execute API, which is thread-safe. spectrum turns every FFT
+// output into magnitudes or powers, written to row(frame); done(frame) is
+// called once that row is complete. Real is the precision of the windowed
+// frames and the FFT; spectra are always float.
+template <typename Real, typename Row, typename Done>
+void computeFrames(const AudioView &audio, int hop_size,
+                   const std::vector<Real> &window,
+                   const BasicBatchedFFT<Real> &fft,
+                   void (*spectrum)(const typename FFTW<Real>::Complex *, int,
+                                    float *),
+                   int begin, int end, Row row, Done done) {
+  int fft_size = fft.fftSize();
+  int batch = fft.batch();
+  int n_bins = fft_size / 2 + 1;
+
+  Real *batch_in = fft.allocInput();
+  typename FFTW<Real>::Complex *batch_out = fft.allocOutput();
+
+  for (int first = begin; first < end; first += batch) {
+    int count = std::min(batch, end - first);
+
+    // Apply window and copy to FFT input, reading straight from the audio;
+    // unused slots of the last batch are zeroed and their output ignored
+    for (int k = 0; k < count; k++) {
+      audio.read((int64_t)(first + k) * hop_size, fft_size,
+                 batch_in + (size_t)k * fft_size, &window[0]);
+    }
+    if (count < batch) {
+      memset(batch_in + (size_t)count * fft_size, 0,
+             sizeof(Real) * fft_size * (batch - count));
+    }
+
+    // Execute FFT
+    fft.execute(batch_in, batch_out);
+
+    // Compute magnitude (or power) spectrum
+    for (int k = 0; k < count; k++) {
+      spectrum(batch_out + (size_t)k * n_bins, n_bins, row(first + k));
+      done(first + k);
+    }
+  }
+
+  fft.release(batch_in);
+  fft.release(batch_out);
+}
+
+// STFT computation. Frames are split across n_threads workers, each running
+// computeFrames over its share.
+template <typename Real>
+Matrix<float>
+computeSTFT(const AudioView &audio, int hop_size,
+            const std::vector<Real> &window, const BasicBatchedFFT<Real> &fft,
+            void (*spectrum)(const typename FFTW<Real>::Complex *, int,
+                             float *),
+            int n_threads) {
+
+  int n_frames = countFrames(audio.length, fft.fftSize(), hop_size);
+  int n_bins = fft.fftSize() / 2 + 1;
+
+  Matrix<float> spectrogram(n_frames, n_bins);
+
+  parallelFor(n_frames, n_threads, [&](int begin, int end) {
+    computeFrames(
+        audio, hop_size, window, fft, spectrum, begin, end,
+        [&](int frame) { return spectrogram.row(frame); }, [](int) {});
+  });
+
+  return spectrogram;
+}
+
+// Apply mel filterbank to spectrogram, finishing every frame with finish
+Matrix<float> applyMelFilterbank(const Matrix<float> &spectrogram,
+                                 const MelFilterbank &filterbank,
+                                 FrameFinisher &finish) {
+
+  int n_frames = spectrogram.rows();
+
+  Matrix<float> mel_spec(n_frames, filterbank.n_mels);
+
+  for (int frame = 0; frame < n_frames; frame++) {
+    applyMelFilterbankFrame(spectrogram.row(frame), filterbank,
+                            mel_spec.row(frame));
+    finish(mel_spec.row(frame), filterbank.n_mels);
+  }
+
+  return mel_spec;
+}
+
+// Mel frames pooled into a fixed number of image columns as they are
+// produced (-width), so only width x n_mels mel values are held whatever the
+// duration, in the batch pipeline (see computePooledSTFT) as in the
+// streaming one. Column c pools frames [c * n_frames / width,
+// (c + 1) * n_frames / width), or repeats its nearest frame when there are
+// fewer frames than columns. Pooling runs on the linear mel values (max,
+// mean, or rms: the root of the mean energy); dB conversion and the value
+// range are applied to the finished columns.
+class ColumnPool {
+public:
+  enum Mode { Max, Mean, RMS };
+
+private:
+  int n_frames_;
+  Mode mode_;
+  Matrix<float> columns_;
+  std::vector<int> counts_;
+
+public:
+  ColumnPool(int n_frames, int width, int n_mels, const std::string &mode)
+      : n_frames_(n_frames),
+        mode_(mode == "mean" ? Mean : mode == "rms" ? RMS : Max),
+        columns_(n_frames > 0 ? width : 0, n_mels),
+        counts_(columns_.rows(), 0) {}
+
+  int frames() const { return n_frames_; }
+  int width() const { return columns_.rows(); }
+
+  // Frames that contribute to columns [begin, end), as [first, last)
+  void framesOf(int begin, int end, int &first, int &last) const {
+    int width = columns_.rows();
+    first = (int)((int64_t)begin * n_frames_ / width);
+    last = (int)std::min<int64_t>(
+        ((int64_t)end * n_frames_ + width - 1) / width, n_frames_);
+  }
+
+  // Accumulate frame into every column it covers within [begin, end), so
+  // workers owning disjoint column ranges can share the pool
+  void add(int frame, const float *RESTRICT mel, int begin, int end) {
+    int width = columns_.rows();
+    int n_mels = columns_.cols();
+    int last = (int)(((int64_t)(frame + 1) * width + n_frames_ - 1) /
+                     n_frames_) - 1;
+    int first = std::min(
+        (int)(((int64_t)frame * width + n_frames_ - 1) / n_frames_), last);
+    first = std::max(first, begin);
+    last = std::min(last, end - 1);
+
+    for (int c = first; c <= last; c++) {
+      float *RESTRICT out = columns_.row(c);
+      if (mode_ == Max) {
+        for (int m = 0; m < n_mels; m++) {
+          out[m] = std::max(out[m], mel[m]);
+        }
+      } else if (mode_ == Mean) {
+        for (int m = 0; m < n_mels; m++) {
+          out[m] += mel[m];
+        }
+      } else {
+        for (int m = 0; m < n_mels; m++) {
+          out[m] += mel[m] * mel[m];
+        }
+      }
+      counts_[c]++;
+    }
+  }
+
+  // Accumulate frame into every column it covers
+  void add(int frame, const float *RESTRICT mel) {
+    add(frame, mel, 0, columns_.rows());
+  }
+
+  // Complete the averages, finish every column and hand the columns over
+  Matrix<float> finish(FrameFinisher &finish) {
+    int n_mels = columns_.cols();
+    for (int c = 0; c < columns_.rows(); c++) {
+      float *RESTRICT column = columns_.row(c);
+      if (mode_ != Max && counts_[c] > 1) {
+        float scale = 1.0f / counts_[c];
+        for (int m = 0; m < n_mels; m++) {
+          column[m] *= scale;
+        }
+      }
+      if (mode_ == RMS) {
+        for (int m = 0; m < n_mels; m++) {
+          column[m] = std::sqrt(column[m]);
+        }
+      }
+      finish(column, n_mels);
+    }
+    return std::move(columns_);
+  }
+};
+
+// Apply mel filterbank to spectrogram, pooling the frames into columns
+void applyMelFilterbank(const Matrix<float> &spectrogram,
+                        const MelFilterbank &filterbank, ColumnPool &pool) {
+  std::vector<float> mel_frame(filterbank.n_mels);
+  for (int frame = 0; frame < spectrogram.rows(); frame++) {
+    applyMelFilterbankFrame(spectrogram.row(frame), filterbank, &mel_frame[0]);
+    pool.add(frame, &mel_frame[0]);
+  }
+}
+
+// STFT and mel projection straight into a column pool, without the linear
+// spectrogram: each frame is pooled as soon as its spectrum is computed.
+// Workers own disjoint column ranges and add their frames in order, so the
+// columns match a single-threaded pass exactly; only a frame shared by two
+// ranges is transformed twice.
+template <typename Real>
+void computePooledSTFT(const AudioView &audio, int hop_size,
+                       const std::vector<Real> &window,
+                       const BasicBatchedFFT<Real> &fft,
+                       void (*spectrum)(const typename FFTW<Real>::Complex *,
+                                        int, float *),
+                       const MelFilterbank &filterbank, ColumnPool &pool,
+                       int n_threads) {
+  if (pool.width() == 0) {
+    return;
+  }
+  parallelFor(pool.width(), n_threads, [&](int begin, int end) {
+    int first, last;
+    pool.framesOf(begin, end, first, last);
+    std::vector<float> magnitude(fft.fftSize() / 2 + 1);
+    std::vector<float> mel_frame(filterbank.n_mels);
+    computeFrames(audio, hop_size, window, fft, spectrum, first, last,
+                  [&](int) { return &magnitude[0]; },
+                  [&](int frame) {
+                    applyMelFilterbankFrame(&magnitude[0], filterbank,
+                                            &mel_frame[0]);
+                    pool.add(frame, &mel_frame[0], begin, end);
+                  });
+  });
+}
+
+// Streaming STFT + mel projection. Samples are pushed block by block into a
+// ring buffer of fft_size samples, and every frame is windowed, transformed
+// and projected onto the mel filterbank as soon as its last sample arrives,
+// so memory depends on the number of frames, not on the number of samples.
+// mel_spec must be sized for every frame of the render up front, unless the
+// frames go to a column pool. Real is the precision of the samples and the
+// FFT, as in computeSTFT.
+template <typename Real> class BasicStreamingAnalyzer {
+private:
+  typedef typename FFTW<Real>::Complex Complex;
+
+  int fft_size_;
+  int hop_size_;
+  int n_bins_;
+  const std::vector<Real> &window_;
+  const MelFilterbank &filterbank_;
+  Matrix<float> &mel_spec_;
+  FrameFinisher &finish_;
+  MatrixExport *linear_export_;
+  ColumnPool *pool_;
+  int n_frames_;
+  int frame_index_;
+
+  std::vector<Real> ring_;
+  int64_t written_;    // Total number of samples pushed
+  int64_t next_frame_; // Start sample of the next frame
+
+  const BasicBatchedFFT<Real> &fft_;
+  void (*spectrum_)(const Complex *, int, float *);
+  Real *in_;
+  Complex *out_;
+  std::vector<float> magnitude_;
+  std::vector<float> mel_frame_; // Frame being pooled
+
+  void processFrame() {
+    // Unroll the ring buffer into the FFT input, applying the window
+    int head = (int)(next_frame_ % fft_size_);
+    int tail = fft_size_ - head;
+    for (int i = 0; i < tail; i++) {
+      in_[i] = ring_[head + i] * window_[i];
+    }
+    for (int i = 0; i < head; i++) {
+      in_[tail + i] = ring_[i] * window_[tail + i];
+    }
+
+    fft_.execute(in_, out_);
+    spectrum_(out_, n_bins_, &magnitude_[0]);
+    if (linear_export_) {
+      linear_export_->writeRow(&magnitude_[0]);
+    }
+
+    if (pool_) {
+      applyMelFilterbankFrame(&magnitude_[0], filterbank_, &mel_frame_[0]);
+      pool_->add(frame_index_++, &mel_frame_[0]);
+      return;
+    }
+    float *mel_frame = mel_spec_.row(frame_index_++);
+    applyMelFilterbankFrame(&magnitude_[0], filterbank_, mel_frame);
+    finish_(mel_frame, filterbank_.n_mels);
+  }
+
+public:
+  // fft must be a single-frame plan (batch of 1). Every mel frame goes
+  // through finish, or into pool when given (mel_spec and finish are then
+  // unused). Linear magnitude frames are also written to linear_export when
+  // given.
+  BasicStreamingAnalyzer(int hop_size, const std::vector<Real> &window,
+                         const BasicBatchedFFT<Real> &fft,
+                         void (*spectrum)(const Complex *, int, float *),
+                         const MelFilterbank &filterbank,
+                         Matrix<float> &mel_spec, FrameFinisher &finish,
+                         MatrixExport *linear_export = nullptr,
+                         ColumnPool *pool = nullptr)
+      : fft_size_(fft.fftSize()), hop_size_(hop_size),
+        n_bins_(fft.fftSize() / 2 + 1), window_(window),
+        filterbank_(filterbank), mel_spec_(mel_spec),
+        finish_(finish), linear_export_(linear_export), pool_(pool),
+        n_frames_(pool ? pool->frames() : mel_spec.rows()), frame_index_(0),
+        ring_(fft.fftSize(), Real(0)), written_(0), next_frame_(0), fft_(fft),
+        spectrum_(spectrum), in_(fft.allocInput()), out_(fft.allocOutput()),
+        magnitude_(n_bins_), mel_frame_(pool ? filterbank.n_mels : 0) {}
+
+  ~BasicStreamingAnalyzer() {
+    fft_.release(in_);
+    fft_.release(out_);
+  }
+
+  int framesAnalyzed() const { return frame_index_; }
+
+  // Feed count samples. Copies stop exactly at each frame end so the ring
+  // always holds the last fft_size samples when a frame is processed.
+  void push(const Real *samples, int count) {
+    while (count > 0) {
+      int64_t frame_end = next_frame_ + fft_size_;
+      int n = (int)std::min<int64_t>(count, frame_end - written_);
+
+      for (int left = n; left > 0;) {
+        int pos = (int)(written_ % fft_size_);
+        int chunk = std::min(left, fft_size_ - pos);
+        memcpy(&ring_[pos], samples, sizeof(Real) * chunk);
+        written_ += chunk;
+        samples += chunk;
+        left -= chunk;
+      }
+      count -= n;
+
+      if (written_ == frame_end && frame_index_ < n_frames_) {
+        processFrame();
+        next_frame_ += hop_size_;
+      }
+    }
+  }
+
+private:
+  BasicStreamingAnalyzer(const BasicStreamingAnalyzer &);
+  BasicStreamingAnalyzer &operator=(const BasicStreamingAnalyzer &);
+};
+
+typedef BasicStreamingAnalyzer<Sample> StreamingAnalyzer;
+
+//==============================================================================
+// Colormap Functions
+//==============================================================================
+
+struct RGB {
+  unsigned char r, g, b;
+};
+
+// Polynomial fit of a perceptual colormap, evaluated by Horner's rule.
+// The coefficients are least-squares fits to the matplotlib tables and stay
+// within about 1/255 of them.
+RGB evaluatePolynomial(float t, const float (*c)[3]) {
+  RGB color;
+  unsigned char *channels[3] = {&color.r, &color.g, &color.b};
+  for (int k = 0; k < 3; k++) {
+    float v = c[6][k];
+    for (int i = 5; i >= 0; i--) {
+      v = v * t + c[i][k];
+    }
+    v = std::max(0.0f, std::min(1.0f, v));
+    *channels[k] = (unsigned char)(v * 255.0f + 0.5f);
+  }
+  return color;
+}
+
+const float kViridis[7][3] = {
+    {0.2777273272234177f, 0.005407344544966578f, 0.3340998053353061f},
+    {0.1050930431085774f, 1.404613529898575f, 1.384590162594685f},
+    {-0.3308618287255563f, 0.214847559468213f, 0.09509516302823659f},
+    {-4.634230498983486f, -5.799100973351585f, -19.33244095627987f},
+    {6.228269936347081f, 14.17993336680509f, 56.69055260068105f},
+    {4.776384997670288f, -13.74514537774601f, -65.35303263337234f},
+    {-5.435455855934631f, 4.645852612178535f, 26.3124352495832f}};
+
+const float kMagma[7][3] = {
+    {-0.002136485053939582f, -0.000749655052795221f, -0.005386127855323933f},
+    {0.2516605407371642f, 0.6775232436837668f, 2.494026599312351f},
+    {8.353717279216625f, -3.577719514958484f, 0.3144679030132573f},
+    {-27.66873308576866f, 14.26473078096533f, -13.64921318813922f},
+    {52.17613981234068f, -27.94360607168351f, 12.94416944238394f},
+    {-50.76852536473588f, 29.04658282127291f, 4.23415299384598f},
+    {18.65570506591883f, -11.48977351997711f, -5.601961508734096f}};
+
+const float kInferno[7][3] = {
+    {0.0002189403691192265f, 0.001651004631001012f, -0.01948089843709184f},
+    {0.1065134194856116f, 0.5639564367884091f, 3.932712388889277f},
+    {11.60249308247187f, -3.972853965665698f, -15.9423941062914f},
+    {-41.70399613139459f, 17.43639888205313f, 44.35414519872813f},
+    {77.162935699427f, -33.40235894210092f, -81.80730925738993f},
+    {-71.31942824499214f, 32.62606426397723f, 73.20951985803202f},
+    {25.13112622477341f, -12.24266895238567f, -23.07032500287172f}};
+
+// Colormap policies, evaluated at value in [0, 1]. They are only used to
+// fill the lookup table, never per pixel.
+struct PolynomialColors {
+  const float (*coefficients)[3];
+
+  explicit PolynomialColors(const float (*c)[3]) : coefficients(c) {}
+
+  RGB operator()(float value) const {
+    return evaluatePolynomial(value, coefficients);
+  }
+};
+
+struct GrayColors {
+  RGB operator()(float value) const {
+    unsigned char gray = (unsigned char)(value * 255);
+    RGB color = {gray, gray, gray};
+    return color;
+  }
+};
+
+struct HotColors {
+  RGB operator()(float value) const {
+    RGB color;
+    if (value < 0.33f) {
+      color.r = (unsigned char)(value / 0.33f * 255);
+      color.g = 0;
+      color.b = 0;
+    } else if (value < 0.66f) {
+      color.r = 255;
+      color.g = (unsigned char)((value - 0.33f) / 0.33f * 255);
+      color.b = 0;
+    } else {
+      color.r = 255;
+      color.g = 255;
+      color.b = (unsigned char)((value - 0.66f) / 0.34f * 255);
+    }
+    return color;
+  }
+};
+
+// Colormap resolved once into a fixed-size lookup table. Pixels are produced
+// by quantizing the normalized value and indexing the table, so the per-pixel
+// cost is the same for every map.
+class Colormap {
+public:
+  static const int kSize = 4096;
+
+private:
+  RGB lut_[kSize];
+
+  template <typename Map> void fill(const Map &map) {
+    for (int i = 0; i < kSize; i++) {
+      lut_[i] = map((float)i / (kSize - 1));
+    }
+  }
+
+public:
+  // Unknown names fall back to hot
+  explicit Colormap(const std::string &name) {
+    if (name == "viridis") {
+      fill(PolynomialColors(kViridis));
+    } else if (name == "magma") {
+      fill(PolynomialColors(kMagma));
+    } else if (name == "inferno") {
+      fill(PolynomialColors(kInferno));
+    } else if (name == "gray") {
+      fill(GrayColors());
+    } else {
+      fill(HotColors());
+    }
+  }
+
+  // Table index of a normalized value
+  static uint16_t index(float value) {
+    float v = std::max(0.0f, std::min(1.0f, value));
+    return (uint16_t)(v * (float)(kSize - 1) + 0.5f);
+  }
+
+  // Map count table indices to colors
+  void map(const uint16_t *RESTRICT indices, int count,
+           RGB *RESTRICT out) const {
+    for (int i = 0; i < count; i++) {
+      out[i] = lut_[indices[i]];
+    }
+  }
+};
+
+// Colormap indices of a spectrogram, in a single pass that normalizes every
+// value from [min_val, max_val] to [0, 1] and quantizes it. Values outside
+// the range saturate. The indices take half the memory of the values, and
+// everything downstream (scaling, tiles, panels) only looks up colors.
+Matrix<uint16_t> quantizeSpectrogram(const Matrix<float> &mel_spec,
+                                     float min_val, float max_val,
+                                     int n_threads) {
+  Matrix<uint16_t> indices(mel_spec.rows(), mel_spec.cols());
+  float range = max_val - min_val;
+
+  parallelFor(mel_spec.rows(), n_threads, [&](int begin, int end) {
+    for (int frame = begin; frame < end; frame++) {
+      const float *RESTRICT row = mel_spec.row(frame);
+      uint16_t *RESTRICT out = indices.row(frame);
+      if (range > 0) {
+        for (int i = 0; i < mel_spec.cols(); i++) {
+          out[i] = Colormap::index((row[i] - min_val) / range);
+        }
+      } else {
+        for (int i = 0; i < mel_spec.cols(); i++) {
+          out[i] = Colormap::index(row[i]);
+        }
+      }
+    }
+  });
+
+  return indices;
+}
+
+//==============================================================================
+// PNG Generation
+//==============================================================================
+
+// libpng write callback appending to a byte vector
+void appendPNGData(png_structp png, png_bytep data, png_size_t length) {
+  auto *bytes = (std::vector<unsigned char> *)png_get_io_ptr(png);
+  bytes->insert(bytes->end(), data, data + length);
+}
+
+// libpng filter mask for a -png-filter name ("auto" lets libpng choose)
+int pngFilterFlags(const std::string &filter) {
+  if (filter == "none") {
+    return PNG_FILTER_NONE;
+  } else if (filter == "sub") {
+    return PNG_FILTER_SUB;
+  } else if (filter == "up") {
+    return PNG_FILTER_UP;
+  } else if (filter == "avg") {
+    return PNG_FILTER_AVG;
+  } else if (filter == "paeth") {
+    return PNG_FILTER_PAETH;
+  }
+  return PNG_ALL_FILTERS;
+}
+
+// Encode a width x height RGB image whose rows are produced on demand by
+// fill_row(y, row), to filename or appended to *bytes when bytes is given.
+// Rows go through a single row buffer and are handed to libpng one at a
+// time, so the image is never held in memory whatever its size.
+template <typename FillRow>
+bool encodePNG(const std::string &filename, int width, int height,
+               const Options &opts, std::vector<unsigned char> *bytes,
+               FillRow fill_row) {
+  std::vector<RGB> row(width);
+
+  FILE *const fp = bytes ? nullptr : fopen(filename.c_str(), "wb");
+  if (!bytes && !fp) {
+    std::cerr << "Error: Could not open file " << filename << std::endl;
+    return false;
+  }
+
+  png_structp png =
+      png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if (!png) {
+    if (fp) {
+      fclose(fp);
+    }
+    return false;
+  }
+
+  png_infop info = png_create_info_struct(png);
+  if (!info) {
+    png_destroy_write_struct(&png, NULL);
+    if (fp) {
+      fclose(fp);
+    }
+    return false;
+  }
+
+  if (setjmp(png_jmpbuf(png))) {
+    png_destroy_write_struct(&png, &info);
+    if (fp) {
+      fclose(fp);
+    }
+    return false;
+  }
+
+  if (fp) {
+    png_init_io(png, fp);
+  } else {
+    png_set_write_fn(png, bytes, appendPNGData, NULL);
+  }
+
+  // Compression settings (-1 keeps the zlib default)
+  if (opts.png_level >= 0) {
+    png_set_compression_level(png, opts.png_level);
+  }
+  if (opts.png_filter != "auto") {
+    png_set_filter(png, PNG_FILTER_TYPE_BASE, pngFilterFlags(opts.png_filter));
+  }
+
+  // Set image attributes
+  png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGB,
+               PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+               PNG_FILTER_TYPE_DEFAULT);
+
+  png_write_info(png, info);
+
+  for (int y = 0; y < height; y++) {
+    fill_row(y, &row[0]);
+    png_write_row(png, (png_bytep)&row[0]);
+  }
+
+  png_write_end(png, NULL);
+
+  // Cleanup
+  png_destroy_write_struct(&png, &info);
+  if (fp) {
+    fclose(fp);
+  }
+
+  return true;
+}
+
+// Image width of n_frames columns of data. With -width the frames were
+// already pooled into exactly that many columns.
+int imageWidth(int n_frames, const Options &opts) {
+  if (opts.width > 0) {
+    return n_frames;
+  }
+  return (int)(n_frames * opts.hscale * opts.scale);
+}
+
+// Height of a panel of n_mels bands
+int panelHeight(int n_mels, const Options &opts) {
+  if (opts.height > 0) {
+    return opts.height;
+  }
+  return (int)(n_mels * opts.vscale * opts.scale);
+}
+
+// Write the spectrograms to filename as panels stacked from top to bottom,
+// or append the encoded PNG to *bytes when bytes is given (filename is then
+// ignored)
+bool writePNG(const std::string &filename,
+              const std::vector<Matrix<uint16_t>> &panels, const Options &opts,
+              float gate_time, std::vector<unsigned char> *bytes = nullptr) {
+
+  int n_frames = panels[0].rows();
+  int n_mels = panels[0].cols();
+  int n_panels = (int)panels.size();
+
+  // Apply scaling
+  int width = imageWidth(n_frames, opts);
+  int panel_height = panelHeight(n_mels, opts);
+  int height = panel_height * n_panels;
+
+  // Simple check
+  if (width <= 0 || panel_height <= 0) {
+    std::cerr << "Error: Invalid image dimensions" << std::endl;
+    return false;
+  }
+
+  Colormap colormap(opts.colormap);
+
+  // Frame index of every column (nearest neighbor)
+  std::vector<int> frame_of_column(width);
+  for (int x = 0; x < width; x++) {
+    frame_of_column[x] = std::min((int)((int64_t)x * n_frames / width),
+                                  n_frames - 1);
+  }
+
+  // Gather each row's indices, then colormap the whole row
+  std::vector<uint16_t> values(width);
+  return encodePNG(
+      filename, width, height, opts, bytes, [&](int y, RGB *row) {
+        const Matrix<uint16_t> &mel_spec = panels[y / panel_height];
+        int panel_y = y % panel_height;
+        int mel_idx =
+            (int)((int64_t)(panel_height - 1 - panel_y) * n_mels / panel_height);
+        mel_idx = std::min(mel_idx, n_mels - 1);
+
+        for (int x = 0; x < width; x++) {
+          values[x] = mel_spec(frame_of_column[x], mel_idx);
+        }
+        colormap.map(&values[0], width, row);
+      });
+}
+
+//==============================================================================
+// Tile Pyramid
+//==============================================================================
+
+// Halve the time resolution: frame i of the result pools frames 2i and
+// 2i + 1 of level (an odd last frame is carried over alone). Pooling works
+// on colormap indices; the mean rounds half up.
+Matrix<uint16_t> poolFrames(const Matrix<uint16_t> &level, bool use_max) {
+  int n_frames = (level.rows() + 1) / 2;
+  int n_mels = level.cols();
+  Matrix<uint16_t> pooled(n_frames, n_mels);
+
+  for (int f = 0; f < n_frames; f++) {
+    const uint16_t *RESTRICT a = level.row(2 * f);
+    uint16_t *RESTRICT out = pooled.row(f);
+    if (2 * f + 1 >= level.rows()) {
+      std::copy(a, a + n_mels, out);
+    } else if (use_max) {
+      const uint16_t *RESTRICT b = level.row(2 * f + 1);
+      for (int m = 0; m < n_mels; m++) {
+        out[m] = std::max(a[m], b[m]);
+      }
+    } else {
+      const uint16_t *RESTRICT b = level.row(2 * f + 1);
+      for (int m = 0; m < n_mels; m++) {
+        out[m] = (uint16_t)((a[m] + b[m] + 1) >> 1);
+      }
+    }
+  }
+  return pooled;
+}
+
+// Write the quantized spectrogram as a zoomable pyramid of tile_size
+// square tiles under dir:
+//
+//   <dir>/<level>/<x>_<y>.png   tile column x, row y of a level
+//   <dir>/index.json            geometry of every level
+//
+// Level 0 is the full resolution image; each following level is built from
+// the previous one by pooling pairs of frames, until a level fits in a
+// single column of tiles. Tiles on the right and bottom edges are smaller.
+// n_frames is the number of STFT frames behind mel_spec, which differs from
+// its rows when they were pooled into -width columns.
+bool writeTilePyramid(const Matrix<uint16_t> &mel_spec, int n_frames,
+                      const std::string &dir, const Options &opts) {
+  const int tile_size = opts.tile_size;
+  const bool use_max = (opts.tile_pool == "max");
+  const int n_mels = mel_spec.cols();
+  const int height = panelHeight(n_mels, opts);
+  const int n_threads = resolveThreads(opts.threads);
+
+  if (height <= 0 || imageWidth(mel_spec.rows(), opts) <= 0) {
+    std::cerr << "Error: Invalid image dimensions" << std::endl;
+    return false;
+  }
+
+  Colormap colormap(opts.colormap);
+
+  // Time step of a level 0 column: one hop, or the share of the frames
+  // pooled into each -width column
+  double column_seconds = (double)opts.hop_size / opts.sample_rate;
+  if (opts.width > 0) {
+    column_seconds *= (double)n_frames / mel_spec.rows();
+  }
+
+  std::ostringstream levels_json;
+  Matrix<uint16_t> pooled;
+  const Matrix<uint16_t> *level = &mel_spec;
+  bool ok = true;
+
+  for (int k = 0; ok; k++) {
+    const int n_frames = level->rows();
+    const int width = std::max(1, imageWidth(n_frames, opts));
+    const int columns = (width + tile_size - 1) / tile_size;
+    const int rows = (height + tile_size - 1) / tile_size;
+
+    std::ostringstream level_dir;
+    level_dir << dir << "/" << k;
+    if (!makeDirectories(level_dir.str())) {
+      std::cerr << "Error: Could not create " << level_dir.str() << std::endl;
+      return false;
+    }
+
+    info(opts) << "  Level " << k << ": " << width << "x" << height << ", "
+               << columns * rows << " tiles" << std::endl;
+
+    // Tiles are independent: encode them in parallel
+    std::vector<char> tile_ok(columns * rows, 0);
+    parallelFor(columns * rows, n_threads, [&](int begin, int end) {
+      std::vector<uint16_t> values(tile_size);
+      for (int t = begin; t < end; t++) {
+        int tx = t % columns;
+        int ty = t / columns;
+        int x0 = tx * tile_size;
+        int y0 = ty * tile_size;
+        int tile_width = std::min(tile_size, width - x0);
+        int tile_height = std::min(tile_size, height - y0);
+
+        std::ostringstream file;
+        file << level_dir.str() << "/" << tx << "_" << ty << ".png";
+        tile_ok[t] = encodePNG(
+            file.str(), tile_width, tile_height, opts, nullptr,
+            [&](int y, RGB *row) {
+              int mel_idx =
+                  (int)((int64_t)(height - 1 - (y0 + y)) * n_mels / height);
+              mel_idx = std::min(mel_idx, n_mels - 1);
+
+              for (int x = 0; x < tile_width; x++) {
+                int frame = std::min(
+                    (int)((int64_t)(x0 + x) * n_frames / width), n_frames - 1);
+                values[x] = (*level)(frame, mel_idx);
+              }
+              colormap.map(&values[0], tile_width, row);
+            });
+      }
+    });
+    ok = std::find(tile_ok.begin(), tile_ok.end(), 0) == tile_ok.end();
+
+    levels_json << (k > 0 ? ",\n" : "") << "    {\"level\": " << k
+                << ", \"frames\": " << n_frames << ", \"width\": " << width
+                << ", \"columns\": " << columns << ", \"rows\": " << rows
+                << ", \"seconds_per_frame\": "
+                << column_seconds * ((int64_t)1 << k)
+                << "}";
+
+    if (columns == 1 || n_frames == 1) {
+      break;
+    }
+    pooled = poolFrames(*level, use_max);
+    level = &pooled;
+  }
+
+  if (!ok) {
+    std::cerr << "Error: Could not write tiles to " << dir << std::endl;
+    return false;
+  }
+
+  std::string index_file = dir + "/index.json";
+  std::ofstream index(index_file.c_str());
+  index << "{\n"
+        << "  \"tile_size\": " << tile_size << ",\n"
+        << "  \"height\": " << height << ",\n"
+        << "  \"mel_bands\": " << n_mels << ",\n"
+        << "  \"sample_rate\": " << opts.sample_rate << ",\n"
+        << "  \"hop\": " << opts.hop_size << ",\n"
+        << "  \"duration\": " << opts.duration << ",\n"
+        << "  \"fmin\": " << opts.fmin << ",\n"
+        << "  \"fmax\": " << opts.fmax << ",\n"
+        << "  \"db\": " << (opts.use_db ? "true" : "false") << ",\n"
+        << "  \"pooling\": \"" << opts.tile_pool << "\",\n"
+        << "  \"path\": \"{level}/{x}_{y}.png\",\n"
+        << "  \"levels\": [\n"
+        << levels_json.str() << "\n  ]\n}\n";
+  if (!index) {
+    std::cerr << "Error: Could not write " << index_file << std::endl;
+    return false;
+  }
+  return true;
+}
+
+//==============================================================================
+// Live Output
+//==============================================================================
+
+// Writer for -live: every mel frame is written as soon as the streaming
+// analyzer finishes it, then flushed, so a reader on a pipe or FIFO can draw
+// the spectrogram while the render runs. There is no header; a frame is
+// mel_bands values from the lowest band up:
+//
+//   f32  float32 (native byte order), the values exported by -export
+//   rgb  3 bytes per band, colormapped over the fixed -dbmin..-dbmax range
+//        (without -db, the frames are converted to dB here)
+class LiveOutput {
+private:
+  FILE *fp_;
+  bool rgb_;
+  bool to_db_;
+  bool fast_log_;
+  float db_factor_;
+  float min_val_;
+  float max_val_;
+  Colormap colormap_;
+  std::vector<float> db_frame_;
+  std::vector<uint16_t> indices_;
+  std::vector<RGB> pixels_;
+
+public:
+  explicit LiveOutput(const Options &opts)
+      : fp_(nullptr), rgb_(opts.live_format == "rgb"),
+        to_db_(rgb_ && !opts.use_db), fast_log_(opts.fast_log),
+        db_factor_(dbFactor(opts)), min_val_(opts.db_min),
+        max_val_(opts.db_max), colormap_(opts.colormap),
+        db_frame_(to_db_ ? opts.mel_bands : 0), indices_(opts.mel_bands),
+        pixels_(opts.mel_bands) {}
+
+  ~LiveOutput() { close(); }
+
+  // path "-" is stdout. Opening a FIFO blocks until a reader connects.
+  bool open(const std::string &path) {
+    // A reader that goes away must not kill the render
+    signal(SIGPIPE, SIG_IGN);
+    fp_ = path == "-" ? stdout : fopen(path.c_str(), "wb");
+    if (!fp_) {
+      std::cerr << "Error: Could not open " << path << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool write(const float *frame, int count) {
+    bool ok;
+    if (rgb_) {
+      if (to_db_) {
+        std::copy(frame, frame + count, db_frame_.begin());
+        convertRowToDb(&db_frame_[0], count, min_val_, db_factor_, fast_log_);
+        frame = &db_frame_[0];
+      }
+      float range = max_val_ - min_val_;
+      for (int i = 0; i < count; i++) {
+        indices_[i] = Colormap::index((frame[i] - min_val_) / range);
+      }
+      colormap_.map(&indices_[0], count, &pixels_[0]);
+      ok = fwrite(&pixels_[0], sizeof(RGB), count, fp_) == (size_t)count;
+    } else {
+      ok = fwrite(frame, sizeof(float), count, fp_) == (size_t)count;
+    }
+    return ok && fflush(fp_) == 0;
+  }
+
+  void close() {
+    if (fp_ && fp_ != stdout) {
+      fclose(fp_);
+    } else if (fp_) {
+      fflush(fp_);
+    }
+    fp_ = nullptr;
+  }
+
+private:
+  LiveOutput(const LiveOutput &);
+  LiveOutput &operator=(const LiveOutput &);
+};
+
+//==============================================================================
+// Spectrogram Generation
+//==============================================================================
+
+// Window, mel filterbank and FFT plans for one set of analysis options.
+// Built once per render, or kept warm across jobs by the render server. The
+// plans are created on first use so a render only pays for the one it needs.
+class AnalysisSetup {
+private:
+  int fft_size_;
+  unsigned plan_flags_;
+  std::unique_ptr<BatchedFFT> batch_fft_;
+  std::unique_ptr<BatchedFFT> frame_fft_;
+
+public:
+  std::vector<Sample> window;
+  MelFilterbank filterbank;
+  SpectrumKernel spectrum; // Magnitude or power, for the selected CPU kernels
+
+  explicit AnalysisSetup(const Options &opts)
+      : fft_size_(opts.fft_size), plan_flags_(planFlags(opts.plan_mode)),
+        window(createWindow<Sample>(opts.fft_size, opts.window_type)),
+        filterbank(createMelFilterbank(opts.mel_bands, opts.fft_size,
+                                       opts.sample_rate, opts.fmin,
+                                       opts.fmax)),
+        spectrum(opts.power ? spectralKernels().power
+                            : spectralKernels().magnitude) {}
+
+  // Plan over kFFTBatch frames, for the batch STFT
+  const BatchedFFT &batchFFT() {
+    if (!batch_fft_) {
+      batch_fft_.reset(new BatchedFFT(fft_size_, kFFTBatch, plan_flags_));
+    }
+    return *batch_fft_;
+  }
+
+  // Single-frame plan, for the streaming analyzer
+  const BatchedFFT &frameFFT() {
+    if (!frame_fft_) {
+      frame_fft_.reset(new BatchedFFT(fft_size_, 1, plan_flags_));
+    }
+    return *frame_fft_;
+  }
+
+  // Options that determine the setup; equal keys can share one setup
+  static std::string key(const Options &opts) {
+    std::ostringstream oss;
+    oss << opts.fft_size << "|" << opts.window_type << "|" << opts.mel_bands
+        << "|" << opts.sample_rate << "|" << opts.fmin << "|" << opts.fmax
+        << "|" << opts.plan_mode << "|" << opts.power;
+    return oss.str();
+  }
+
+private:
+  AnalysisSetup(const AnalysisSetup &);
+  AnalysisSetup &operator=(const AnalysisSetup &);
+};
+
+// Output path of one of several signals: "-<name>" is inserted before the
+// extension. A single signal keeps the path unchanged.
+std::string signalPath(const std::string &path,
+                       const std::vector<SignalSource> &signals, size_t s) {
+  return signals.size() == 1 ? path : suffixedPath(path, "-" + signals[s].name);
+}
+
+// Export one matrix (mel, or linear when opts.export_linear) to path
+bool exportMatrix(const Matrix<float> &matrix, const std::string &path,
+                  const Options &opts, bool convert_db) {
+  MatrixExport exporter;
+  if (!exporter.open(path, matrix.rows(), matrix.cols(), opts,
+                     !opts.export_linear, convert_db) ||
+      !exporter.writeMatrix(matrix) || !exporter.close()) {
+    std::cerr << "✗ Failed to export " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Export, quantization and image output, shared by both pipelines.
+// mel_specs holds one finished spectrogram per signal (already in dB when
+// requested) and range the value range over all of them; they are quantized
+// with one common scale and written as stacked panels or as one file each
+// (-panels). n_frames is the number of STFT frames of each signal. When
+// png_bytes is given the PNG is encoded in memory instead of written.
+bool finishSpectrogram(std::vector<Matrix<float>> &mel_specs, int n_frames,
+                       const ValueRange &range,
+                       const std::vector<SignalSource> &signals,
+                       const Options &opts, const std::string &output_file,
+                       std::vector<unsigned char> *png_bytes) {
+  if (mel_specs[0].empty()) {
+    std::cerr << "✗ Not enough audio for a single FFT frame" << std::endl;
+    return false;
+  }
+
+  // Export the values before they are normalized away
+  if (!opts.export_file.empty() && !opts.export_linear) {
+    ProfileScope export_scope("export");
+    for (size_t s = 0; s < mel_specs.size(); s++) {
+      std::string path = signalPath(opts.export_file, signals, s);
+      info(opts) << "  Exporting: " << path << std::endl;
+      if (!exportMatrix(mel_specs[s], path, opts, false)) {
+        return false;
+      }
+    }
+  }
+
+  if (!opts.write_png) {
+    info(opts) << "✓ Done (image output disabled)" << std::endl;
+    return true;
+  }
+
+  // Quantize to colormap indices, releasing each float matrix once done
+  float min_val = range.min;
+  float max_val = range.max;
+  if (opts.norm == "fixed") {
+    min_val = opts.db_min;
+    max_val = opts.db_max;
+  }
+  info(opts) << "  Quantizing " << min_val << " .. " << max_val << "..."
+             << std::endl;
+  int n_threads = resolveThreads(opts.threads);
+  ProfileScope quantize_scope("quantize");
+  std::vector<Matrix<uint16_t>> indices(mel_specs.size());
+  for (size_t s = 0; s < mel_specs.size(); s++) {
+    indices[s] = quantizeSpectrogram(mel_specs[s], min_val, max_val, n_threads);
+    mel_specs[s] = Matrix<float>();
+  }
+  quantize_scope.stop();
+
+  // Colormap lookup and PNG encoding run row by row, so they are timed
+  // together
+  ProfileScope encode_scope(opts.tiles_dir.empty() ? "encode" : "tiles");
+
+  // Calculate gate time in frames
+  float gate_time = opts.gate_duration;
+
+  if (!opts.tiles_dir.empty()) {
+    for (size_t s = 0; s < indices.size(); s++) {
+      std::string dir = signalPath(opts.tiles_dir, signals, s);
+      info(opts) << "  Writing tile pyramid: " << dir << std::endl;
+      if (!writeTilePyramid(indices[s], n_frames, dir, opts)) {
+        std::cerr << "✗ Failed to write tile pyramid" << std::endl;
+        return false;
+      }
+      info(opts) << "✓ Tiles saved to: " << dir << std::endl;
+    }
+    return true;
+  }
+
+  // One file per signal; in-memory output is always a single image
+  if (opts.panels == "files" && indices.size() > 1 && !png_bytes) {
+    for (size_t s = 0; s < indices.size(); s++) {
+      std::string path = signalPath(output_file, signals, s);
+      std::vector<Matrix<uint16_t>> panel(1);
+      panel[0] = std::move(indices[s]);
+      info(opts) << "  Writing PNG: " << path << std::endl;
+      if (!writePNG(path, panel, opts, gate_time)) {
+        std::cerr << "✗ Failed to write PNG" << std::endl;
+        return false;
+      }
+      info(opts) << "✓ Spectrogram saved to: " << path << std::endl;
+    }
+    return true;
+  }
+
+  // Write PNG
+  info(opts) << "  Writing PNG: " << output_file << std::endl;
+  if (writePNG(output_file, indices, opts, gate_time, png_bytes)) {
+    info(opts) << "✓ Spectrogram saved to: " << output_file << std::endl;
+    return true;
+  } else {
+    std::cerr << "✗ Failed to write PNG" << std::endl;
+    return false;
+  }
+}
+
+// Batch pipeline over fully synthesized signals. The signals are analyzed
+// concurrently, each with its share of the worker threads.
+bool generateSpectrogram(const std::vector<AudioView> &audio,
+                         const std::vector<SignalSource> &signals,
+                         const Options &opts, AnalysisSetup &setup,
+                         const std::string &output_file,
+                         std::vector<unsigned char> *png_bytes) {
+  info(opts) << "Generating spectrogram..." << std::endl;
+  info(opts) << "  Audio samples: " << audio[0].length << std::endl;
+  if (signals.size() > 1) {
+    info(opts) << "  Signals: " << signals.size() << std::endl;
+  }
+  info(opts) << "  FFT size: " << opts.fft_size << std::endl;
+  info(opts) << "  Hop size: " << opts.hop_size << std::endl;
+  info(opts) << "  Mel bands: " << opts.mel_bands << std::endl;
+  info(opts) << "  Kernels: " << spectralKernels().name << std::endl;
+  if (opts.width > 0) {
+    info(opts) << "  Columns: " << opts.width << " (" << opts.pool
+               << " pooling)" << std::endl;
+  }
+
+  // Compute STFT and apply mel filterbank
+  info(opts) << "  Computing STFT..." << std::endl;
+  info(opts) << "  Applying mel filterbank..." << std::endl;
+  ProfileScope plan_scope("setup");
+  const BatchedFFT &fft = setup.batchFFT();
+  plan_scope.stop();
+  int n_signals = (int)signals.size();
+  int n_threads = resolveThreads(opts.threads);
+  int threads_per_signal = std::max(1, n_threads / n_signals);
+  bool export_linear = !opts.export_file.empty() && opts.export_linear;
+
+  std::vector<Matrix<float>> mel_specs(n_signals);
+  std::vector<FrameFinisher> finishers(n_signals, FrameFinisher(opts));
+  std::vector<char> ok(n_signals, 1);
+  parallelFor(n_signals, n_threads, [&](int begin, int end) {
+    for (int s = begin; s < end; s++) {
+      // With -width and no linear export, frames go straight to the pool
+      if (opts.width > 0 && !export_linear) {
+        int n_frames =
+            countFrames(audio[s].length, opts.fft_size, opts.hop_size);
+        ColumnPool pool(n_frames, opts.width, setup.filterbank.n_mels,
+                        opts.pool);
+        ProfileScope stft_scope("stft");
+        computePooledSTFT(audio[s], opts.hop_size, setup.window, fft,
+                          setup.spectrum, setup.filterbank, pool,
+                          threads_per_signal);
+        stft_scope.stop();
+        ProfileScope mel_scope("mel");
+        mel_specs[s] = pool.finish(finishers[s]);
+        mel_scope.stop();
+        Profiler::instance().addFrames(n_frames);
+        continue;
+      }
+
+      ProfileScope stft_scope("stft");
+      auto spectrogram = computeSTFT(audio[s], opts.hop_size, setup.window,
+                                     fft, setup.spectrum, threads_per_signal);
+      stft_scope.stop();
+      if (export_linear) {
+        ProfileScope export_scope("export");
+        ok[s] = exportMatrix(spectrogram,
+                             signalPath(opts.export_file, signals, s), opts,
+                             opts.use_db);
+      }
+      ProfileScope mel_scope("mel");
+      if (opts.width > 0) {
+        ColumnPool pool(spectrogram.rows(), opts.width,
+                        setup.filterbank.n_mels, opts.pool);
+        applyMelFilterbank(spectrogram, setup.filterbank, pool);
+        mel_specs[s] = pool.finish(finishers[s]);
+      } else {
+        mel_specs[s] =
+            applyMelFilterbank(spectrogram, setup.filterbank, finishers[s]);
+      }
+      mel_scope.stop();
+      Profiler::instance().addFrames(spectrogram.rows());
+    }
+  });
+  if (std::find(ok.begin(), ok.end(), 0) != ok.end()) {
+    return false;
+  }
+
+  ValueRange range;
+  for (const auto &finisher : finishers) {
+    range.merge(finisher.range);
+  }
+  int n_frames = countFrames(audio[0].length, opts.fft_size, opts.hop_size);
+  return finishSpectrogram(mel_specs, n_frames, range, signals, opts,
+                           output_file, png_bytes);
+}
+
+// Streaming variant: synthesis (or file reading), STFT and mel projection
+// run block by block, so neither the audio nor the linear spectrogram is
+// ever held in memory. Every signal has its own analyzer fed from the same
+// blocks. engine is a SynthEngine or an AudioFileReader rendering
+// n_channels channels.
+template <typename Engine>
+bool generateSpectrogramStreaming(Engine &engine, int n_channels,
+                                  const std::vector<SignalSource> &signals,
+                                  const Options &opts, AnalysisSetup &setup,
+                                  const std::string &output_file,
+                                  std::vector<unsigned char> *png_bytes) {
+  int n_frames = countFrames(engine.numSamples(), opts.fft_size, opts.hop_size);
+  int n_signals = (int)signals.size();
+
+  info(opts) << "Generating spectrogram (streaming)..." << std::endl;
+  info(opts) << "  Audio samples: " << engine.numSamples() << std::endl;
+  if (n_signals > 1) {
+    info(opts) << "  Signals: " << n_signals << std::endl;
+  }
+  info(opts) << "  FFT size: " << opts.fft_size << std::endl;
+  info(opts) << "  Hop size: " << opts.hop_size << std::endl;
+  info(opts) << "  Mel bands: " << opts.mel_bands << std::endl;
+  info(opts) << "  Kernels: " << spectralKernels().name << std::endl;
+  if (opts.width > 0) {
+    info(opts) << "  Columns: " << opts.width << " (" << opts.pool
+               << " pooling)" << std::endl;
+  }
+
+  // Frames are kept whole, or pooled into -width columns
+  std::vector<Matrix<float>> mel_specs(n_signals);
+  std::vector<std::unique_ptr<ColumnPool>> pools(n_signals);
+  for (int s = 0; s < n_signals; s++) {
+    if (opts.width > 0) {
+      pools[s].reset(
+          new ColumnPool(n_frames, opts.width, opts.mel_bands, opts.pool));
+    } else {
+      mel_specs[s].resize(n_frames, opts.mel_bands);
+    }
+  }
+  std::vector<FrameFinisher> finishers(n_signals, FrameFinisher(opts));
+
+  // Linear frames are exported as they are produced
+  std::vector<std::unique_ptr<MatrixExport>> linear_exports(n_signals);
+  if (!opts.export_file.empty() && opts.export_linear) {
+    for (int s = 0; s < n_signals; s++) {
+      std::string path = signalPath(opts.export_file, signals, s);
+      info(opts) << "  Exporting: " << path << std::endl;
+      linear_exports[s].reset(new MatrixExport());
+      if (!linear_exports[s]->open(path, n_frames, opts.fft_size / 2 + 1,
+                                   opts, false, opts.use_db)) {
+        return false;
+      }
+    }
+  }
+
+  // Frames of the first signal are also written out as they are finished
+  std::unique_ptr<LiveOutput> live;
+  if (!opts.live_path.empty()) {
+    info(opts) << "  Live output: " << opts.live_path << std::endl;
+    live.reset(new LiveOutput(opts));
+    if (!live->open(opts.live_path)) {
+      return false;
+    }
+  }
+  int live_frames = 0;
+
+  // Synthesize and analyze block by block
+  info(opts) << "  Synthesizing and computing STFT..." << std::endl;
+  {
+    ProfileScope plan_scope("setup");
+    const BatchedFFT &fft = setup.frameFFT();
+    plan_scope.stop();
+    std::vector<std::unique_ptr<StreamingAnalyzer>> analyzers(n_signals);
+    for (int s = 0; s < n_signals; s++) {
+      analyzers[s].reset(new StreamingAnalyzer(opts.hop_size, setup.window,
+                                               fft, setup.spectrum,
+                                               setup.filterbank,
+                                               mel_specs[s], finishers[s],
+                                               linear_exports[s].get(),
+                                               pools[s].get()));
+    }
+
+    int block_size = std::max(1, opts.block_size);
+    std::vector<Sample> blocks(block_size * std::max(n_channels, 1));
+    std::vector<Sample> mix(block_size);
+    std::vector<Sample *> channels(std::max(n_channels, 1));
+    for (int c = 0; c < (int)channels.size(); c++) {
+      channels[c] = &blocks[c * block_size];
+    }
+
+    while (!engine.done()) {
+      ProfileScope synthesis_scope(Engine::kStage);
+      int count = engine.render(&channels[0], n_channels, block_size);
+      synthesis_scope.stop();
+
+      ProfileScope analysis_scope("analysis");
+      for (int s = 0; s < n_signals; s++) {
+        if (signals[s].kind == SignalSource::Channel) {
+          analyzers[s]->push(channels[signals[s].channel], count);
+        } else {
+          mixSignal(signals[s], &channels[0], n_channels, count, &mix[0]);
+          analyzers[s]->push(&mix[0], count);
+        }
+      }
+
+      for (; live && live_frames < analyzers[0]->framesAnalyzed();
+           live_frames++) {
+        if (!live->write(mel_specs[0].row(live_frames), opts.mel_bands)) {
+          std::cerr << "Warning: live output closed, continuing without it"
+                    << std::endl;
+          live.reset();
+        }
+      }
+    }
+    info(opts) << "  Analyzed " << analyzers[0]->framesAnalyzed() << " frames"
+               << std::endl;
+    Profiler::instance().addSamples(engine.numSamples());
+    for (const auto &analyzer : analyzers) {
+      Profiler::instance().addFrames(analyzer->framesAnalyzed());
+    }
+  }
+
+  for (auto &linear_export : linear_exports) {
+    if (linear_export && !linear_export->close()) {
+      std::cerr << "✗ Failed to export " << opts.export_file << std::endl;
+      return false;
+    }
+  }
+
+  for (int s = 0; s < n_signals; s++) {
+    if (pools[s]) {
+      mel_specs[s] = pools[s]->finish(finishers[s]);
+    }
+  }
+
+  ValueRange range;
+  for (const auto &finisher : finishers) {
+    range.merge(finisher.range);
+  }
+  return finishSpectrogram(mel_specs, n_frames, range, signals, opts,
+                           output_file, png_bytes);
+}
+
+// Synthesize and analyze one render with the DSP's current state
+bool renderSpectrogram(dsp &dsp, SpectrogramUI &ui, const Options &opts,
+                       AnalysisSetup &setup, const std::string &output_file,
+                       std::vector<unsigned char> *png_bytes = nullptr) {
+  std::vector<SignalSource> signals;
+  std::string error_msg;
+  if (!resolveSignals(opts.channels, dsp.getNumOutputs(), signals,
+                      error_msg)) {
+    std::cerr << error_msg << std::endl;
+    return false;
+  }
+
+  if (opts.stream) {
+    // Synthesize and analyze in one bounded-memory pass
+    SynthEngine engine(dsp, ui, opts);
+    return generateSpectrogramStreaming(
+        engine, capturedChannels(signals, dsp.getNumOutputs()), signals, opts,
+        setup, output_file, png_bytes);
+  }
+
+  // Synthesize audio
+  info(opts) << "Synthesizing audio..." << std::endl;
+  std::vector<std::vector<Sample>> channels(
+      capturedChannels(signals, dsp.getNumOutputs()));
+  ProfileScope synthesis_scope("synthesis");
+  synthesizeAudio(dsp, ui, opts, channels);
+  synthesis_scope.stop();
+  Profiler::instance().addSamples(channels[0].size());
+  info(opts) << "  Generated " << channels[0].size() << " samples"
+             << (channels.size() > 1 ? " per channel" : "") << std::endl;
+  info(opts) << std::endl;
+
+  // Channels are analyzed in place, mixes are computed once
+  std::vector<std::vector<Sample>> mixes(signals.size());
+  std::vector<AudioView> audio(signals.size());
+  std::vector<const Sample *> channel_data(channels.size());
+  for (size_t c = 0; c < channels.size(); c++) {
+    channel_data[c] = channels[c].data();
+  }
+  ProfileScope mix_scope("mix");
+  for (size_t s = 0; s < signals.size(); s++) {
+    if (signals[s].kind == SignalSource::Channel) {
+      audio[s] = AudioView(channels[signals[s].channel]);
+    } else {
+      mixes[s].resize(channels[0].size());
+      mixSignal(signals[s], &channel_data[0], (int)channels.size(),
+                (int64_t)mixes[s].size(), mixes[s].data());
+      audio[s] = AudioView(mixes[s]);
+    }
+  }
+  mix_scope.stop();
+
+  // Generate spectrogram
+  return generateSpectrogram(audio, signals, opts, setup, output_file,
+                             png_bytes);
+}
+
+// Analyze the -input recording with the pipeline used for synthesized audio.
+// Channels are read in place from the mapped file; only mixes (mid, side,
+// sum) are materialized.
+bool renderAudioFile(const Options &opts, const std::string &output_file) {
+  AudioFile audio;
+  std::string error_msg;
+  if (!openAudioFile(opts, audio, error_msg)) {
+    std::cerr << error_msg << std::endl;
+    return false;
+  }
+
+  // The analysis runs at the rate of the recording
+  Options file_opts = opts;
+  file_opts.sample_rate = audio.sample_rate;
+  file_opts.duration = (float)((double)audio.frames / audio.sample_rate);
+  if (file_opts.fmax < 0) {
+    file_opts.fmax = audio.sample_rate / 2.0;
+  }
+
+  info(opts) << "Reading " << opts.input_file << "..." << std::endl;
+  info(opts) << "  " << audio.channels << " channel"
+             << (audio.channels > 1 ? "s" : "") << " at " << audio.sample_rate
+             << " Hz, " << audio.frames << " samples ("
+             << file_opts.duration << " s)" << std::endl;
+  info(opts) << std::endl;
+
+  std::vector<SignalSource> signals;
+  if (!resolveSignals(opts.channels, audio.channels, signals, error_msg)) {
+    std::cerr << error_msg << std::endl;
+    return false;
+  }
+
+  ProfileScope setup_scope("setup");
+  AnalysisSetup setup(file_opts);
+  setup_scope.stop();
+
+  std::vector<AudioView> channels(
+      capturedChannels(signals, audio.channels));
+  for (size_t c = 0; c < channels.size(); c++) {
+    channels[c] = audio.channel((int)c);
+  }
+
+  if (file_opts.stream) {
+    AudioFileReader reader(channels, audio.frames, file_opts);
+    return generateSpectrogramStreaming(reader, (int)channels.size(), signals,
+                                        file_opts, setup, output_file,
+                                        nullptr);
+  }
+
+  std::vector<std::vector<Sample>> mixes(signals.size());
+  std::vector<AudioView> views(signals.size());
+  ProfileScope mix_scope("mix");
+  for (size_t s = 0; s < signals.size(); s++) {
+    if (signals[s].kind == SignalSource::Channel) {
+      views[s] = channels[signals[s].channel];
+    } else {
+      mixes[s].resize(audio.frames);
+      mixSignal(signals[s], channels, audio.frames, mixes[s].data());
+      views[s] = AudioView(mixes[s]);
+    }
+  }
+  mix_scope.stop();
+  Profiler::instance().addSamples(audio.frames);
+
+  return generateSpectrogram(views, signals, file_opts, setup, output_file,
+                             nullptr);
+}
+
+//==============================================================================
+// Parameter Sweep
+//==============================================================================
+
+struct SweepPoint {
+  float duration;
+  float gate_duration;
+  float frequency;
+  float gain;
+};
+
+// Field of a sweep point by name, or nullptr for an unknown name
+float *sweepField(SweepPoint &point, const std::string &name) {
+  if (name == "duration") {
+    return &point.duration;
+  } else if (name == "gate" || name == "gate_duration") {
+    return &point.gate_duration;
+  } else if (name == "freq" || name == "frequency") {
+    return &point.frequency;
+  } else if (name == "gain") {
+    return &point.gain;
+  }
+  return nullptr;
+}
+
+// path with "-NNNN" inserted before its extension
+std::string indexedPath(const std::string &path, size_t index) {
+  std::ostringstream oss;
+  oss << "-" << std::setfill('0') << std::setw(4) << index;
+  return suffixedPath(path, oss.str());
+}
 
-  for (const auto &frame : mel_spec) {
-    for (float val : frame) {
-      min_val = std::min(min_val, val);
-      max_val = std::max(max_val, val);
+std::vector<std::string> splitString(const std::string &str, char sep) {
+  std::vector<std::string> parts;
+  std::istringstream iss(str);
+  std::string part;
+  while (std::getline(iss, part, sep)) {
+    size_t first = part.find_first_not_of(" \t\r");
+    size_t last = part.find_last_not_of(" \t\r");
+    parts.push_back(first == std::string::npos
+                        ? ""
+                        : part.substr(first, last - first + 1));
+  }
+  return parts;
+}
+
+// Parse "name=a:b:n" (n values from a to b) or "name=v1,v2,..."
+bool parseSweepAxis(const std::string &spec, std::string &name,
+                    std::vector<float> &values, std::string &error_msg) {
+  size_t eq = spec.find('=');
+  if (eq == std::string::npos) {
+    error_msg = "Error: sweep axis must look like name=values: " + spec;
+    return false;
+  }
+  name = spec.substr(0, eq);
+  std::string rhs = spec.substr(eq + 1);
+
+  values.clear();
+  if (rhs.find(':') != std::string::npos) {
+    std::vector<std::string> range = splitString(rhs, ':');
+    int count = (range.size() == 3) ? atoi(range[2].c_str()) : 0;
+    if (count < 1) {
+      error_msg = "Error: sweep range must look like a:b:n with n >= 1: " + spec;
+      return false;
+    }
+    float start = atof(range[0].c_str());
+    float end = atof(range[1].c_str());
+    for (int i = 0; i < count; i++) {
+      values.push_back(count == 1 ? start
+                                  : start + (end - start) * i / (count - 1));
+    }
+  } else {
+    for (const auto &value : splitString(rhs, ',')) {
+      if (!value.empty()) {
+        values.push_back(atof(value.c_str()));
+      }
     }
   }
 
-  float range = max_val - min_val;
-  if (range > 0) {
-    for (auto &frame : mel_spec) {
-      for (auto &val : frame) {
-        val = (val - min_val) / range;
+  if (values.empty()) {
+    error_msg = "Error: sweep axis has no values: " + spec;
+    return false;
+  }
+  return true;
+}
+
+// Expand the CSV rows and sweep axes into the list of points to render.
+// Every axis multiplies the points built so far (a full grid).
+bool buildSweep(const Options &opts, std::vector<SweepPoint> &points,
+                std::string &error_msg) {
+  SweepPoint base = {opts.duration, opts.gate_duration, opts.frequency,
+                     opts.gain};
+  points.clear();
+
+  if (!opts.sweep_csv.empty()) {
+    std::ifstream csv(opts.sweep_csv.c_str());
+    if (!csv) {
+      error_msg = "Error: could not open sweep file " + opts.sweep_csv;
+      return false;
+    }
+
+    std::vector<std::string> header;
+    std::string line;
+    while (std::getline(csv, line)) {
+      std::vector<std::string> cells = splitString(line, ',');
+      if (cells.empty() || cells[0].empty() || cells[0][0] == '#') {
+        continue;
+      }
+      if (header.empty()) {
+        header = cells;
+        for (const auto &column : header) {
+          if (sweepField(base, column) == nullptr) {
+            error_msg = "Error: unknown sweep column \"" + column +
+                        "\" (expected duration, gate, freq, gain)";
+            return false;
+          }
+        }
+        continue;
+      }
+      SweepPoint point = base;
+      for (size_t i = 0; i < cells.size() && i < header.size(); i++) {
+        *sweepField(point, header[i]) = atof(cells[i].c_str());
+      }
+      points.push_back(point);
+    }
+  } else {
+    points.push_back(base);
+  }
+
+  for (const auto &spec : opts.sweep_axes) {
+    std::string name;
+    std::vector<float> values;
+    if (!parseSweepAxis(spec, name, values, error_msg)) {
+      return false;
+    }
+    if (sweepField(base, name) == nullptr) {
+      error_msg = "Error: unknown sweep parameter \"" + name +
+                  "\" (expected duration, gate, freq, gain)";
+      return false;
+    }
+
+    std::vector<SweepPoint> grid;
+    for (const auto &point : points) {
+      for (float value : values) {
+        SweepPoint p = point;
+        *sweepField(p, name) = value;
+        grid.push_back(p);
       }
     }
+    points.swap(grid);
   }
+
+  return true;
 }
 
-//==============================================================================
-// Colormap Functions
-//==============================================================================
+// Render every sweep point from one binary. Workers each clone the DSP
+// (with their own SpectrogramUI binding) and render a contiguous share of
+// the points; a CSV manifest maps point parameters to output files.
+int runSweep(dsp &prototype, const Options &opts,
+             const std::string &output_file) {
+  std::vector<SweepPoint> points;
+  std::string error_msg;
+  if (!buildSweep(opts, points, error_msg)) {
+    std::cerr << error_msg << std::endl;
+    return 1;
+  }
 
-struct RGB {
-  unsigned char r, g, b;
-};
+  // <base>-0000.png, <base>-0001.png, ... next to <base>-sweep.csv
+  std::string base = output_file;
+  if (base.size() > 4 && base.substr(base.size() - 4) == ".png") {
+    base = base.substr(0, base.size() - 4);
+  }
+  std::vector<std::string> files(points.size());
+  for (size_t i = 0; i < points.size(); i++) {
+    std::ostringstream name;
+    name << base << "-" << std::setfill('0') << std::setw(4) << i << ".png";
+    files[i] = name.str();
+  }
 
-RGB applyColormap(float value, const std::string &colormap) {
-  // Clamp value to [0, 1]
-  value = std::max(0.0f, std::min(1.0f, value));
+  int n_jobs = resolveThreads(opts.jobs);
+  std::cout << "Sweeping " << points.size() << " points with "
+            << std::min<size_t>(n_jobs, points.size()) << " jobs..."
+            << std::endl;
+
+  std::vector<char> ok(points.size(), 0);
+  std::mutex progress_mutex;
+  int completed = 0;
+
+  parallelFor((int)points.size(), n_jobs, [&](int begin, int end) {
+    dsp *worker = prototype.clone();
+    SpectrogramUI ui;
+    worker->buildUserInterface(&ui);
+
+    for (int i = begin; i < end; i++) {
+      Options point_opts = opts;
+      point_opts.duration = points[i].duration;
+      point_opts.gate_duration = points[i].gate_duration;
+      point_opts.frequency = points[i].frequency;
+      point_opts.gain = points[i].gain;
+      point_opts.quiet = true;
+      point_opts.threads = 1; // Points already run in parallel
+      if (!opts.export_file.empty()) {
+        point_opts.export_file = indexedPath(opts.export_file, i);
+      }
+      if (!opts.tiles_dir.empty()) {
+        point_opts.tiles_dir = indexedPath(opts.tiles_dir, i);
+      }
 
-  RGB color;
+      worker->init(point_opts.sample_rate);
+      ProfileScope setup_scope("setup");
+      AnalysisSetup setup(point_opts);
+      setup_scope.stop();
+      ok[i] = renderSpectrogram(*worker, ui, point_opts, setup, files[i]);
 
-  if (colormap == "viridis") {
-    // Simplified viridis approximation
-    if (value < 0.25f) {
-      float t = value / 0.25f;
-      color.r = (unsigned char)(68 * (1 - t) + 59 * t);
-      color.g = (unsigned char)(1 * (1 - t) + 82 * t);
-      color.b = (unsigned char)(84 * (1 - t) + 139 * t);
-    } else if (value < 0.5f) {
-      float t = (value - 0.25f) / 0.25f;
-      color.r = (unsigned char)(59 * (1 - t) + 33 * t);
-      color.g = (unsigned char)(82 * (1 - t) + 145 * t);
-      color.b = (unsigned char)(139 * (1 - t) + 140 * t);
-    } else if (value < 0.75f) {
-      float t = (value - 0.5f) / 0.25f;
-      color.r = (unsigned char)(33 * (1 - t) + 94 * t);
-      color.g = (unsigned char)(145 * (1 - t) + 201 * t);
-      color.b = (unsigned char)(140 * (1 - t) + 98 * t);
-    } else {
-      float t = (value - 0.75f) / 0.25f;
-      color.r = (unsigned char)(94 * (1 - t) + 253 * t);
-      color.g = (unsigned char)(201 * (1 - t) + 231 * t);
-      color.b = (unsigned char)(98 * (1 - t) + 37 * t);
-    }
-  } else if (colormap == "magma") {
-    // Simplified magma
-    color.r = (unsigned char)(value * 252);
-    color.g = (unsigned char)(value * value * 180);
-    color.b = (unsigned char)(std::pow(value, 0.5f) * 200);
-  } else if (colormap == "hot") {
-    // Hot colormap
-    if (value < 0.33f) {
-      color.r = (unsigned char)(value / 0.33f * 255);
-      color.g = 0;
-      color.b = 0;
-    } else if (value < 0.66f) {
-      color.r = 255;
-      color.g = (unsigned char)((value - 0.33f) / 0.33f * 255);
-      color.b = 0;
-    } else {
-      color.r = 255;
-      color.g = 255;
-      color.b = (unsigned char)((value - 0.66f) / 0.34f * 255);
+      std::lock_guard<std::mutex> lock(progress_mutex);
+      completed++;
+      info(opts) << "  [" << completed << "/" << points.size() << "] "
+                 << files[i] << (ok[i] ? "" : " (failed)") << std::endl;
     }
-  } else if (colormap == "gray") {
-    // Grayscale
-    unsigned char gray = (unsigned char)(value * 255);
-    color.r = gray;
-    color.g = gray;
-    color.b = gray;
-  } else {
-    // Default to hot
-    return applyColormap(value, "hot");
+
+    delete worker;
+  });
+
+  // Manifest, in point order
+  std::string manifest = base + "-sweep.csv";
+  std::ofstream csv(manifest.c_str());
+  csv << "index,duration,gate,freq,gain,file,ok\n";
+  int failures = 0;
+  for (size_t i = 0; i < points.size(); i++) {
+    csv << i << "," << points[i].duration << "," << points[i].gate_duration
+        << "," << points[i].frequency << "," << points[i].gain << ","
+        << files[i] << "," << (ok[i] ? 1 : 0) << "\n";
+    failures += ok[i] ? 0 : 1;
   }
 
-  return color;
+  std::cout << "✓ Sweep manifest saved to: " << manifest << std::endl;
+  if (failures > 0) {
+    std::cerr << "✗ " << failures << " sweep points failed" << std::endl;
+    return 1;
+  }
+  return 0;
 }
 
 //==============================================================================
-// PNG Generation
+// Render Server
 //==============================================================================
 
-bool writePNG(const std::string &filename,
-              const std::vector<std::vector<float>> &mel_spec,
-              const Options &opts, float gate_time) {
+// One field value of a flat JSON object. Numbers keep their source text so
+// they can be handed to the command line parser unchanged.
+struct JSONValue {
+  enum Type { String, Number, Bool, Null };
+  Type type;
+  std::string text;
+  bool flag;
+};
 
-  int n_frames = mel_spec.size();
-  int n_mels = mel_spec[0].size();
+typedef std::vector<std::pair<std::string, JSONValue>> JSONObject;
 
-  // Apply scaling
-  int width = (int)(n_frames * opts.hscale * opts.scale);
-  int height = (int)(n_mels * opts.vscale * opts.scale);
+// Parser for the flat objects used as jobs: string, number, boolean and
+// null values only, no nesting.
+class JSONReader {
+private:
+  const std::string &text_;
+  size_t pos_;
+  std::string error_;
 
-  // Simple check
-  if (width <= 0 || height <= 0) {
-    std::cerr << "Error: Invalid image dimensions" << std::endl;
+  void skipSpace() {
+    while (pos_ < text_.size() && isspace((unsigned char)text_[pos_])) {
+      pos_++;
+    }
+  }
+
+  bool fail(const std::string &msg) {
+    if (error_.empty()) {
+      std::ostringstream oss;
+      oss << msg << " at offset " << pos_;
+      error_ = oss.str();
+    }
     return false;
   }
 
-  // Create image buffer
-  std::vector<std::vector<RGB>> image(height);
-  for (int y = 0; y < height; y++) {
-    image[y].resize(width);
+  bool expect(char c) {
+    skipSpace();
+    if (pos_ < text_.size() && text_[pos_] == c) {
+      pos_++;
+      return true;
+    }
+    return fail(std::string("expected '") + c + "'");
   }
 
-  // Fill image with nearest-neighbor interpolation (simple)
-  for (int y = 0; y < height; y++) {
-    int mel_idx = (int)((height - 1 - y) * n_mels / height);
-    mel_idx = std::min(mel_idx, n_mels - 1);
+  bool parseString(std::string &out) {
+    if (!expect('"')) {
+      return false;
+    }
+    out.clear();
+    while (pos_ < text_.size() && text_[pos_] != '"') {
+      char c = text_[pos_++];
+      if (c == '\\' && pos_ < text_.size()) {
+        char e = text_[pos_++];
+        switch (e) {
+        case 'n':
+          out += '\n';
+          break;
+        case 't':
+          out += '\t';
+          break;
+        case 'r':
+          out += '\r';
+          break;
+        case 'b':
+          out += '\b';
+          break;
+        case 'f':
+          out += '\f';
+          break;
+        case 'u': {
+          // Basic multilingual plane only, encoded as UTF-8
+          unsigned code = (unsigned)strtoul(text_.substr(pos_, 4).c_str(),
+                                            nullptr, 16);
+          pos_ += 4;
+          if (code < 0x80) {
+            out += (char)code;
+          } else if (code < 0x800) {
+            out += (char)(0xC0 | (code >> 6));
+            out += (char)(0x80 | (code & 0x3F));
+          } else {
+            out += (char)(0xE0 | (code >> 12));
+            out += (char)(0x80 | ((code >> 6) & 0x3F));
+            out += (char)(0x80 | (code & 0x3F));
+          }
+          break;
+        }
+        default:
+          out += e;
+        }
+      } else {
+        out += c;
+      }
+    }
+    return expect('"');
+  }
 
-    for (int x = 0; x < width; x++) {
-      int frame_idx = (int)(x * n_frames / width);
-      frame_idx = std::min(frame_idx, n_frames - 1);
+  bool parseValue(JSONValue &value) {
+    skipSpace();
+    if (pos_ >= text_.size()) {
+      return fail("unexpected end of input");
+    }
+    char c = text_[pos_];
+    value.flag = false;
+    if (c == '"') {
+      value.type = JSONValue::String;
+      return parseString(value.text);
+    } else if (text_.compare(pos_, 4, "true") == 0) {
+      value.type = JSONValue::Bool;
+      value.flag = true;
+      pos_ += 4;
+    } else if (text_.compare(pos_, 5, "false") == 0) {
+      value.type = JSONValue::Bool;
+      pos_ += 5;
+    } else if (text_.compare(pos_, 4, "null") == 0) {
+      value.type = JSONValue::Null;
+      pos_ += 4;
+    } else if (c == '-' || isdigit((unsigned char)c)) {
+      size_t start = pos_;
+      while (pos_ < text_.size() &&
+             strchr("+-.eE0123456789", text_[pos_]) != nullptr) {
+        pos_++;
+      }
+      value.type = JSONValue::Number;
+      value.text = text_.substr(start, pos_ - start);
+    } else {
+      return fail("unsupported value (only strings, numbers, booleans and "
+                  "null are allowed)");
+    }
+    return true;
+  }
+
+public:
+  explicit JSONReader(const std::string &text) : text_(text), pos_(0) {}
 
-      float value = mel_spec[frame_idx][mel_idx];
-      image[y][x] = applyColormap(value, opts.colormap);
+  bool parseObject(JSONObject &fields) {
+    fields.clear();
+    if (!expect('{')) {
+      return false;
+    }
+    skipSpace();
+    if (pos_ < text_.size() && text_[pos_] == '}') {
+      pos_++;
+      return true;
+    }
+    while (true) {
+      std::pair<std::string, JSONValue> field;
+      if (!parseString(field.first) || !expect(':') ||
+          !parseValue(field.second)) {
+        return false;
+      }
+      fields.push_back(field);
+      skipSpace();
+      if (pos_ < text_.size() && text_[pos_] == ',') {
+        pos_++;
+      } else {
+        return expect('}');
+      }
     }
   }
 
-  // Write PNG file
-  FILE *fp = fopen(filename.c_str(), "wb");
-  if (!fp) {
-    std::cerr << "Error: Could not open file " << filename << std::endl;
-    return false;
+  const std::string &error() const { return error_; }
+};
+
+std::string jsonEscape(const std::string &str) {
+  std::ostringstream oss;
+  for (unsigned char c : str) {
+    if (c == '"' || c == '\\') {
+      oss << '\\' << c;
+    } else if (c == '\n') {
+      oss << "\\n";
+    } else if (c < 0x20) {
+      oss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c
+          << std::dec;
+    } else {
+      oss << c;
+    }
   }
+  return oss.str();
+}
 
-  png_structp png =
-      png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-  if (!png) {
-    fclose(fp);
-    return false;
+std::string base64Encode(const std::vector<unsigned char> &data) {
+  static const char table[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  out.reserve((data.size() + 2) / 3 * 4);
+  for (size_t i = 0; i < data.size(); i += 3) {
+    unsigned v = data[i] << 16;
+    if (i + 1 < data.size()) {
+      v |= data[i + 1] << 8;
+    }
+    if (i + 2 < data.size()) {
+      v |= data[i + 2];
+    }
+    out += table[(v >> 18) & 63];
+    out += table[(v >> 12) & 63];
+    out += (i + 1 < data.size()) ? table[(v >> 6) & 63] : '=';
+    out += (i + 2 < data.size()) ? table[v & 63] : '=';
   }
+  return out;
+}
 
-  png_infop info = png_create_info_struct(png);
-  if (!info) {
-    png_destroy_write_struct(&png, NULL);
-    fclose(fp);
-    return false;
+// Render server. Jobs are flat JSON objects, one per line:
+//
+//   {"id": 1, "duration": 2, "gate": 0.5, "freq": 440, "gain": 0.9,
+//    "fft": 4096, "cmap": "magma", "db": true, "o": "out.png"}
+//
+// duration/gate/freq/gain (or duration/gate_duration/frequency/gain) are
+// the positional arguments and must be numbers; every other key is a
+// command line option without its dash (true adds a flag, false omits
+// it), except server, socket, sweep*, live*, profile, bench-synth and
+// input*, which get an error reply. "inline": true returns the PNG
+// base64-encoded in the reply instead of writing a file, and is refused
+// together with no-png or tiles. {"command": "quit"} stops the server.
+//
+// In the plugin host "dsp": "<file.so>" selects the patch. Each patch is
+// loaded on first use and kept until {"command": "unload", "dsp": ...}.
+//
+// DSP instances are reused (cleared between jobs), and windows, filterbanks
+// and FFT plans are cached by the options that determine them.
+class RenderServer {
+private:
+  struct ServedDSP {
+    LoadedDSP loaded;
+    int sample_rate;
+  };
+
+  std::string program_;
+  std::vector<std::string> base_args_;
+  int job_count_;
+  std::map<std::string, std::unique_ptr<ServedDSP>> dsps_;
+  std::map<std::string, std::unique_ptr<AnalysisSetup>> setups_;
+
+  static std::string errorReply(const std::string &id,
+                                const std::string &msg) {
+    return "{" + id + "\"ok\":false,\"error\":\"" + jsonEscape(msg) + "\"}";
   }
 
-  if (setjmp(png_jmpbuf(png))) {
-    png_destroy_write_struct(&png, &info);
-    fclose(fp);
-    return false;
+  // Options that make no sense per job: server setup, sweeps, and the ones
+  // that write outside the reply (-live to stdout would corrupt the
+  // protocol, -profile is only written by main) or replace the render
+  // altogether (-bench-synth, -input)
+  static bool isJobOption(const std::string &key) {
+    return key != "server" && key != "socket" && key != "profile" &&
+           key != "bench-synth" && key.compare(0, 5, "sweep") != 0 &&
+           key.compare(0, 4, "live") != 0 && key.compare(0, 5, "input") != 0;
   }
 
-  png_init_io(png, fp);
+  // Translate a job into command line arguments
+  bool jobArguments(const JSONObject &job, std::vector<std::string> &args,
+                    bool &inline_png, std::string &error_msg) {
+    static const char *positional[4][2] = {{"duration", "duration"},
+                                           {"gate", "gate_duration"},
+                                           {"freq", "frequency"},
+                                           {"gain", "gain"}};
+    args.assign(1, program_);
+    args.insert(args.end(), base_args_.begin(), base_args_.end());
+    inline_png = false;
+
+    // Exactly one numeric value per positional argument, under either name
+    for (int p = 0; p < 4; p++) {
+      const std::pair<std::string, JSONValue> *found = nullptr;
+      for (const auto &field : job) {
+        if (field.first != positional[p][0] &&
+            field.first != positional[p][1]) {
+          continue;
+        }
+        if (found) {
+          error_msg = "\"" + found->first + "\" and \"" + field.first +
+                      "\" both given";
+          return false;
+        }
+        if (field.second.type != JSONValue::Number) {
+          error_msg = "\"" + field.first + "\" must be a number";
+          return false;
+        }
+        found = &field;
+      }
+      if (!found) {
+        error_msg = std::string("missing \"") + positional[p][0] + "\"";
+        return false;
+      }
+      args.push_back(found->second.text);
+    }
 
-  // Set image attributes
-  png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGB,
-               PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
-               PNG_FILTER_TYPE_DEFAULT);
+    for (const auto &field : job) {
+      const std::string &key = field.first;
+      const JSONValue &value = field.second;
+      bool is_positional = false;
+      for (int p = 0; p < 4; p++) {
+        is_positional |= (key == positional[p][0] || key == positional[p][1]);
+      }
+      if (is_positional || key == "id" || value.type == JSONValue::Null) {
+        continue;
+      } else if (key == "inline") {
+        inline_png = value.flag;
+      } else if (!isJobOption(key)) {
+        error_msg = "option \"" + key + "\" is not allowed in a job";
+        return false;
+      } else if (value.type == JSONValue::Bool) {
+        if (value.flag) {
+          args.push_back("-" + key);
+        }
+      } else {
+        args.push_back(key == "output" ? "-o" : "-" + key);
+        args.push_back(value.text);
+      }
+    }
 
-  png_write_info(png, info);
+    // An inline reply carries the PNG, so the job must produce one and
+    // nothing else the client would not hear about
+    if (inline_png) {
+      for (size_t i = 1; i < args.size(); i++) {
+        if (args[i] == "-no-png" || args[i] == "-tiles") {
+          error_msg = "option \"" + args[i].substr(1) +
+                      "\" cannot be combined with \"inline\"";
+          return false;
+        }
+      }
+    }
+    return true;
+  }
 
-  // Write image data
-  std::vector<png_byte *> row_pointers(height);
-  for (int y = 0; y < height; y++) {
-    row_pointers[y] = (png_byte *)&image[y][0];
+public:
+  // argv holds the server's own options; they are the defaults of every job
+  RenderServer(int argc, char *argv[])
+      : program_(argv[0]), job_count_(0) {
+    for (int i = 1; i < argc; i++) {
+      std::string arg = argv[i];
+      if (arg == "-socket") {
+        i++;
+      } else if (arg != "-server") {
+        base_args_.push_back(arg);
+      }
+    }
   }
 
-  png_write_image(png, &row_pointers[0]);
-  png_write_end(png, NULL);
+  // Run one job line and return the reply line (without newline)
+  std::string handle(const std::string &line, bool &quit) {
+    JSONObject job;
+    JSONReader reader(line);
+    if (!reader.parseObject(job)) {
+      return errorReply("", "invalid JSON: " + reader.error());
+    }
 
-  // Cleanup
-  png_destroy_write_struct(&png, &info);
-  fclose(fp);
+    // Echo the job id so clients can match replies
+    std::string id;
+    std::string command;
+    std::string dsp_path;
+    for (const auto &field : job) {
+      if (field.first == "id") {
+        id = "\"id\":" +
+             (field.second.type == JSONValue::String
+                  ? "\"" + jsonEscape(field.second.text) + "\""
+                  : field.second.text) +
+             ",";
+      } else if (field.first == "command") {
+        command = field.second.text;
+      } else if (field.first == "dsp") {
+        dsp_path = field.second.text;
+      }
+    }
 
-  return true;
-}
+    if (command == "quit") {
+      quit = true;
+      return "{" + id + "\"ok\":true}";
+    } else if (command == "ping") {
+      return "{" + id + "\"ok\":true}";
+    } else if (command == "unload") {
+      if (dsps_.erase(dsp_path) == 0) {
+        return errorReply(id, "DSP not loaded: " + dsp_path);
+      }
+      return "{" + id + "\"ok\":true}";
+    } else if (!command.empty()) {
+      return errorReply(id, "unknown command " + command);
+    }
 
-//==============================================================================
-// Spectrogram Generation
-//==============================================================================
+    std::vector<std::string> args;
+    bool inline_png = false;
+    std::string error_msg;
+    if (!jobArguments(job, args, inline_png, error_msg)) {
+      return errorReply(id, error_msg);
+    }
+
+    std::vector<char *> argv;
+    for (auto &arg : args) {
+      argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+
+    Options opts;
+    if (!parseCommandLine((int)args.size(), &argv[0], opts)) {
+      return errorReply(id, "invalid job options (details on stderr)");
+    }
+    opts.quiet = true;
+
+    auto start = std::chrono::steady_clock::now();
+
+    // Reuse the DSP instance: full init only when it is new or the sample
+    // rate changes
+    std::unique_ptr<ServedDSP> &served = dsps_[opts.dsp_plugin];
+    if (!served) {
+      served.reset(new ServedDSP());
+      if (!loadDSP(opts.dsp_plugin, served->loaded, error_msg)) {
+        dsps_.erase(opts.dsp_plugin);
+        return errorReply(id, error_msg);
+      }
+      served->sample_rate = 0;
+    }
+    if (!validateTimeline(opts.timeline, served->loaded.ui, error_msg)) {
+      return errorReply(id, error_msg);
+    }
+    dsp &instance = *served->loaded.instance;
+    if (opts.sample_rate != served->sample_rate) {
+      instance.init(opts.sample_rate);
+      served->sample_rate = opts.sample_rate;
+    } else {
+      instance.instanceClear();
+      instance.instanceResetUserInterface();
+    }
+
+    std::unique_ptr<AnalysisSetup> &setup = setups_[AnalysisSetup::key(opts)];
+    if (!setup) {
+      setup.reset(new AnalysisSetup(opts));
+    }
 
-void generateSpectrogram(const std::vector<float> &audio, const Options &opts,
-                         const std::string &output_file) {
-  std::cout << "Generating spectrogram..." << std::endl;
-  std::cout << "  Audio samples: " << audio.size() << std::endl;
-  std::cout << "  FFT size: " << opts.fft_size << std::endl;
-  std::cout << "  Hop size: " << opts.hop_size << std::endl;
-  std::cout << "  Mel bands: " << opts.mel_bands << std::endl;
+    job_count_++;
+    std::string output_file = opts.output_file;
+    if (output_file.empty() && !inline_png) {
+      std::ostringstream name;
+      std::string base = generateOutputFilename(program_.c_str(), opts);
+      name << base.substr(0, base.size() - 4) << "-" << job_count_ << ".png";
+      output_file = name.str();
+    }
+
+    std::vector<unsigned char> png_bytes;
+    if (!renderSpectrogram(instance, served->loaded.ui, opts, *setup,
+                           output_file,
+                           inline_png ? &png_bytes : nullptr)) {
+      return errorReply(id, "render failed (details on stderr)");
+    }
 
-  // Create window
-  std::vector<float> window = createWindow(opts.fft_size, opts.window_type);
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
 
-  // Compute STFT
-  std::cout << "  Computing STFT..." << std::endl;
-  auto spectrogram = computeSTFT(audio, opts.fft_size, opts.hop_size, window);
+    std::ostringstream reply;
+    reply << "{" << id << "\"ok\":true,\"seconds\":" << seconds;
+    if (inline_png) {
+      reply << ",\"png_base64\":\"" << base64Encode(png_bytes) << "\"";
+    } else {
+      reply << ",\"output\":\"" << jsonEscape(output_file) << "\"";
+    }
+    reply << "}";
+    return reply.str();
+  }
+};
 
-  // Create mel filterbank
-  std::cout << "  Creating mel filterbank..." << std::endl;
-  auto filterbank = createMelFilterbank(opts.mel_bands, opts.fft_size,
-                                        opts.sample_rate, opts.fmin, opts.fmax);
+// Serve jobs read from stdin, replies on stdout
+int serveStdin(RenderServer &server) {
+  std::string line;
+  bool quit = false;
+  while (!quit && std::getline(std::cin, line)) {
+    if (line.find_first_not_of(" \t\r") == std::string::npos) {
+      continue;
+    }
+    std::cout << server.handle(line, quit) << std::endl;
+  }
+  return 0;
+}
 
-  // Apply mel filterbank
-  std::cout << "  Applying mel filterbank..." << std::endl;
-  auto mel_spec = applyMelFilterbank(spectrogram, filterbank);
+bool writeAll(int fd, const std::string &data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = write(fd, data.data() + sent, data.size() - sent);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    sent += n;
+  }
+  return true;
+}
 
-  // Convert to dB if requested
-  if (opts.use_db) {
-    std::cout << "  Converting to dB scale..." << std::endl;
-    convertToDb(mel_spec, opts.db_min);
+// Serve jobs on a Unix domain socket, one connection at a time (the DSP
+// instance is shared). Each connection may send any number of job lines.
+int serveSocket(RenderServer &server, const std::string &path) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "Error: socket path too long: " << path << std::endl;
+    return 1;
   }
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
 
-  // Normalize to [0, 1]
-  std::cout << "  Normalizing..." << std::endl;
-  normalizeSpectrogram(mel_spec);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    std::cerr << "Error: could not create socket" << std::endl;
+    return 1;
+  }
+  unlink(path.c_str());
+  if (bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+    std::cerr << "Error: could not listen on " << path << std::endl;
+    close(fd);
+    return 1;
+  }
 
-  // Calculate gate time in frames
-  float gate_time = opts.gate_duration;
+  // A client hanging up must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+  std::cerr << "Listening on " << path << std::endl;
 
-  // Write PNG
-  std::cout << "  Writing PNG: " << output_file << std::endl;
-  if (writePNG(output_file, mel_spec, opts, gate_time)) {
-    std::cout << "✓ Spectrogram saved to: " << output_file << std::endl;
-  } else {
-    std::cerr << "✗ Failed to write PNG" << std::endl;
+  bool quit = false;
+  while (!quit) {
+    int client = accept(fd, nullptr, nullptr);
+    if (client < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    std::string pending;
+    char buffer[4096];
+    bool connected = true;
+    while (connected && !quit) {
+      ssize_t n = read(client, buffer, sizeof(buffer));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        break;
+      }
+      pending.append(buffer, n);
+
+      size_t newline;
+      while (!quit && (newline = pending.find('\n')) != std::string::npos) {
+        std::string line = pending.substr(0, newline);
+        pending.erase(0, newline + 1);
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+          continue;
+        }
+        if (!writeAll(client, server.handle(line, quit) + "\n")) {
+          connected = false;
+          break;
+        }
+      }
+    }
+    close(client);
   }
+
+  close(fd);
+  unlink(path.c_str());
+  return 0;
 }
 
 //==============================================================================
 // Main
 //==============================================================================
 
+#ifndef SPECTROGRAM_BENCH
+
 int main(int argc, char *argv[]) {
   // Parse command line
   Options opts;
   if (!parseCommandLine(argc, argv, opts)) {
     return 1;
   }
+  selectKernels(opts.simd);
+
+  // Replies own stdout; DSPs are loaded by the jobs that use them
+  if (opts.server) {
+    importWisdom(opts);
+    RenderServer server(argc, argv);
+    int status = opts.socket_path.empty()
+                     ? serveStdin(server)
+                     : serveSocket(server, opts.socket_path);
+    exportWisdom(opts);
+    return status;
+  }
 
-  // Create DSP instance
-  mydsp *dsp = new mydsp();
-  if (dsp == nullptr) {
-    std::cerr << "Failed to create DSP object" << std::endl;
-    return 1;
+  if (!opts.profile_file.empty()) {
+    Profiler::instance().enable();
   }
 
-  // Build UI and validate DSP parameters
-  SpectrogramUI ui;
-  dsp->buildUserInterface(&ui);
+  // Recordings are analyzed without a DSP
+  if (!opts.input_file.empty()) {
+    importWisdom(opts);
+    int status =
+        renderAudioFile(opts, generateOutputFilename(argv[0], opts)) ? 0 : 1;
+    exportWisdom(opts);
+    if (!opts.profile_file.empty() &&
+        !Profiler::instance().write(opts.profile_file, opts)) {
+      status = 1;
+    }
+    return status;
+  }
 
+  // Create DSP instance, build UI and validate DSP parameters
+  LoadedDSP loaded;
   std::string error_msg;
-  if (!ui.validate(error_msg)) {
+  if (!loadDSP(opts.dsp_plugin, loaded, error_msg)) {
+    std::cerr << error_msg << std::endl;
+    return 1;
+  }
+  dsp &instance = *loaded.instance;
+  SpectrogramUI &ui = loaded.ui;
+  if (!validateTimeline(opts.timeline, ui, error_msg)) {
     std::cerr << error_msg << std::endl;
-    delete dsp;
     return 1;
   }
 
   // Initialize DSP
-  dsp->init(opts.sample_rate);
+  instance.init(opts.sample_rate);
 
   // Display parameter info
-  std::cout << "DSP Parameters:" << std::endl;
-  std::cout << "  gate: " << ui.getParameter("gate").type << std::endl;
-  std::cout << "  freq: " << ui.getParameter("freq").type << " ["
-            << ui.getParameter("freq").min << ", "
-            << ui.getParameter("freq").max << "]" << std::endl;
-  std::cout << "  gain: " << ui.getParameter("gain").type << " ["
-            << ui.getParameter("gain").min << ", "
-            << ui.getParameter("gain").max << "]" << std::endl;
-  std::cout << std::endl;
-
-  // Synthesize audio
-  std::cout << "Synthesizing audio..." << std::endl;
-  std::vector<float> audio;
-  synthesizeAudio(*dsp, ui, opts, audio);
-  std::cout << "  Generated " << audio.size() << " samples" << std::endl;
-  std::cout << std::endl;
+  info(opts) << "DSP Parameters:" << std::endl;
+  info(opts) << "  gate: " << ui.getParameter("gate").type << std::endl;
+  info(opts) << "  freq: " << ui.getParameter("freq").type << " ["
+             << ui.getParameter("freq").min << ", "
+             << ui.getParameter("freq").max << "]" << std::endl;
+  info(opts) << "  gain: " << ui.getParameter("gain").type << " ["
+             << ui.getParameter("gain").min << ", "
+             << ui.getParameter("gain").max << "]" << std::endl;
+  info(opts) << std::endl;
+
+  if (opts.bench_synth) {
+    benchmarkSynthesis(instance, ui, opts);
+    return 0;
+  }
 
   // Generate output filename
   std::string output_file = generateOutputFilename(argv[0], opts);
 
-  // Generate spectrogram
-  generateSpectrogram(audio, opts, output_file);
+  // Reuse FFT plans measured by earlier runs
+  importWisdom(opts);
 
-  // Cleanup
-  delete dsp;
+  int status = 0;
+  if (!opts.sweep_axes.empty() || !opts.sweep_csv.empty()) {
+    status = runSweep(instance, opts, output_file);
+  } else {
+    ProfileScope setup_scope("setup");
+    AnalysisSetup setup(opts);
+    setup_scope.stop();
+    if (!renderSpectrogram(instance, ui, opts, setup, output_file)) {
+      status = 1;
+    }
+  }
 
-  return 0;
+  exportWisdom(opts);
+
+  if (!opts.profile_file.empty() &&
+      !Profiler::instance().write(opts.profile_file, opts)) {
+    status = 1;
+  }
+
+  return status;
 }
 
+#endif // SPECTROGRAM_BENCH
+
+#endif // SPECTROGRAM_PLUGIN
+
 /******************* END spectrogram.cpp ****************/
@@ -0,0 +1,92 @@
+#!/bin/bash
+#####################################################################
+# Render server protocol checks: every job line gets exactly one JSON
+# reply line, and options that would write outside the reply are refused.
+#
+# Usage: tests/server_jobs.sh <spectrogram-host> <plugin.so>
+#
+# "make test" builds the host and a plugin of the benchmark stand-in DSP
+# (bench/bench_dsp.h), so no faust is needed.
+#####################################################################
+
+set -e
+
+HOST="$1"
+PLUGIN="$2"
+if [ ! -x "$HOST" ] || [ ! -f "$PLUGIN" ]; then
+    echo "Usage: $0 <spectrogram-host> <plugin.so>"
+    exit 2
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+FAILED=0
+
+# Check that reply line <n> contains <text>
+expect() {
+    local n="$1"
+    local text="$2"
+    local line
+    line=$(sed -n "${n}p" "$WORK/replies")
+    if [[ "$line" != *"$text"* ]]; then
+        echo "FAIL: reply $n: expected $text, got: $line"
+        FAILED=1
+    fi
+}
+
+JOB='"duration": 0.5, "gate": 0.25, "freq": 440, "gain": 0.9, "fft": 512'
+cat > "$WORK/jobs" <<JOBS
+{"id": 1, $JOB, "o": "$WORK/a.png"}
+{"id": 2, $JOB, "live": "-", "live-format": "f32", "no-png": true}
+{"id": 3, $JOB, "live-format": "f32"}
+{"id": 4, $JOB, "profile": "-"}
+{"id": 5, $JOB, "bench-synth": true}
+{"id": 6, $JOB, "input": "$WORK/a.wav"}
+{"id": 7, $JOB, "sweep": "freq=220,440"}
+{"id": 8, $JOB, "socket": "$WORK/socket"}
+{"id": 9, $JOB, "inline": true}
+{"id": 10, "duration": 0.5, "gate": true, "freq": 440, "gain": 0.9}
+{"id": 11, $JOB, "gate_duration": 0.25}
+{"id": 12, $JOB, "inline": true, "no-png": true}
+{"id": 13, $JOB, "tiles": "$WORK/tiles", "inline": true}
+{"command": "quit"}
+JOBS
+
+"$HOST" -dsp "$PLUGIN" -server < "$WORK/jobs" > "$WORK/replies" 2> "$WORK/errors"
+
+# One JSON line per job, nothing else on stdout
+lines=$(wc -l < "$WORK/replies")
+jobs=$(wc -l < "$WORK/jobs")
+if [ "$lines" -ne "$jobs" ]; then
+    echo "FAIL: expected $jobs reply lines, got $lines"
+    FAILED=1
+fi
+if grep -qv '^{.*}$' "$WORK/replies"; then
+    echo "FAIL: non-JSON output on stdout"
+    FAILED=1
+fi
+
+expect 1 '"id":1,"ok":true'
+[ -f "$WORK/a.png" ] || { echo "FAIL: job 1 wrote no PNG"; FAILED=1; }
+expect 2 'option \"live\" is not allowed in a job'
+expect 3 'option \"live-format\" is not allowed in a job'
+expect 4 'option \"profile\" is not allowed in a job'
+expect 5 'option \"bench-synth\" is not allowed in a job'
+expect 6 'option \"input\" is not allowed in a job'
+expect 7 'option \"sweep\" is not allowed in a job'
+expect 8 'option \"socket\" is not allowed in a job'
+expect 9 '"png_base64":"iVBORw0KGgo'
+expect 10 '\"gate\" must be a number'
+expect 11 '\"gate\" and \"gate_duration\" both given'
+expect 12 'option \"no-png\" cannot be combined with \"inline\"'
+expect 13 'option \"tiles\" cannot be combined with \"inline\"'
+[ ! -e "$WORK/tiles" ] || { echo "FAIL: job 13 wrote tiles"; FAILED=1; }
+expect "$jobs" '"ok":true'
+
+if [ $FAILED -ne 0 ]; then
+    echo "Server stderr:"
+    cat "$WORK/errors"
+    exit 1
+fi
+echo "server jobs: all checks passed"